@@ -6,8 +6,88 @@
 #include <list>
 #include <map>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <utility>
+
+// ANSI backend, the colors are escape sequences written together with
+// the text, so it works on any terminal and inside a buffered stream
+namespace ansi
+{
+    // same numbering as the console color codes of hue
+    enum color
+    {
+        black, blue, green, aqua, red, purple, yellow, white, grey,
+        light_blue, light_green, light_aqua, light_red, light_purple,
+        light_yellow, bright_white
+    };
+
+    constexpr std::string_view RESET = "\x1b[0m";
+
+    constexpr std::string_view TEXT[16] = {
+        "30", "34", "32", "36", "31", "35", "33", "37",
+        "90", "94", "92", "96", "91", "95", "93", "97"
+    };
+
+    constexpr std::string_view BACKGROUND[16] = {
+        "40",  "44",  "42",  "46",  "41",  "45",  "43",  "47",
+        "100", "104", "102", "106", "101", "105", "103", "107"
+    };
+
+    struct span;
+
+    // a text and background color, or no color at all for vanilla
+    struct style
+    {
+        int text = -1;
+        int background = -1;
+
+        constexpr span operator()(std::string_view t) const;
+    };
+
+    // a colored text that refers to the text instead of copying it
+    struct span
+    {
+        style colors;
+        std::string_view text;
+    };
+
+    constexpr span style::operator()(std::string_view t) const
+    {
+        return span{*this, t};
+    }
+
+    // the width set on the stream pads the text inside the colored span
+    inline std::ostream & operator<<(std::ostream & os, const span & s)
+    {
+        if (s.colors.text < 0)
+            return os << s.text;
+
+        os.write("\x1b[", 2);
+        os.write(TEXT[s.colors.text].data(), TEXT[s.colors.text].size());
+
+        if (s.colors.background >= 0) {
+            os.put(';');
+            os.write(BACKGROUND[s.colors.background].data(), BACKGROUND[s.colors.background].size());
+        }
+        os.put('m');
+
+        os << s.text;
+        return os.write(RESET.data(), RESET.size());
+    }
+
+    constexpr style vanilla                    {};
+    constexpr style black_on_bright_white      {black, bright_white};
+    constexpr style bright_white_on_blue       {bright_white, blue};
+    constexpr style bright_white_on_green      {bright_white, green};
+    constexpr style bright_white_on_red        {bright_white, red};
+}
+
+// console api backend, only available on Windows
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <windows.h>
 
 namespace hue
@@ -875,4 +955,6 @@ namespace dye
     template<typename T> R<T> bright_white_on_bright_white(T t) { return R<T> { S<T>(t, "bw", "bw") }; }
 }
 
+#endif // _WIN32
+
 #endif
\ No newline at end of file
@@ -14,40 +14,95 @@
 #include <iomanip>
 #include <ctime>
 #include <cctype>
-#include <conio.h>
 #include <map>
+#include <list>
+#include <limits>
+#include <unordered_map>
+#include <set>
+#include <unordered_set>
+#include <filesystem>
+#include <system_error>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CART_TOTAL_SIMD
+#include <immintrin.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <signal.h>
+#else
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <conio.h>
+#include <process.h>
+#endif
 #include "libraries/rapidjson/document.h"
 #include "libraries/rapidjson/ostreamwrapper.h"
 #include "libraries/rapidjson/istreamwrapper.h"
 #include "libraries/rapidjson/prettywriter.h"
+#include "libraries/rapidjson/stringbuffer.h"
+#include "libraries/rapidjson/schema.h"
+#include "libraries/rapidjson/error/en.h"
 #include "libraries/color.hpp"
 
-#define CART_FILE_PATH "data/cart.json"
+#define CATALOG_DIR_PATH "data"
+#define CART_DIR_PATH "data/carts"
+#define CART_MIGRATE_LOCK_PATH "data/carts.lock"
+#define LEGACY_CART_FILE_PATH "data/cart.json"
+#define LEGACY_CART_LOG_PATH "data/cart.log"
+#define CART_COMPACT_RECORDS 1000
+// a file queued for the persister is on disk at most this long after
+#define PERSIST_STALENESS_MS 200
+// times a catalog write is retried after other processes changed the file
+#define CATALOG_COMMIT_RETRIES 10
 #define CREDENTIALS_FILE_PATH "data/credentials.csv"
+#define CREDENTIALS_LOCK_PATH "data/credentials.lock"
+#define CREDENTIALS_REVISION_PATH "data/credentials.rev"
+#define USERID_SEQ_PATH "data/userid.seq"
+#define RECEIPTS_FILE_PATH "data/receipts.jsonl"
+#define SERVER_SOCKET_PATH "data/supermarket.sock"
+// number of orders of batch file parsed together before their stock is committed
+#define BATCH_CHUNK_ORDERS 8192
+// every line of credentials file is padded to a fixed size, so the
+// record of a user can be rewritten in place
+#define USERID_WIDTH 10
+#define USERNAME_WIDTH 12
+#define PASSWORD_WIDTH 8
+#define CREDENTIAL_RECORD_SIZE (USERID_WIDTH + USERNAME_WIDTH + PASSWORD_WIDTH + 3)
 #define WIDTH 70
+// number of products shown on one page of the product table
+#define PRODUCT_PAGE_ROWS 15
+
+// ANSI escape sequences of terminal control
+#define ANSI_CURSOR_HOME "\x1b[H"
+#define ANSI_CLEAR_SCREEN "\x1b[2J"
+#define ANSI_CLEAR_SCROLLBACK "\x1b[3J"
 
 using namespace std;
 using namespace rapidjson;
 
-template<typename T>
-const auto func1 = dye::bright_white_on_blue <T>;
-const auto bg_blue = func1<string>;
-
-template<typename T>
-const auto func2 = dye::black_on_bright_white<T>;
-const auto bg_white = func2<string>;
-
-template<typename T>
-const auto func3 = dye::bright_white_on_red<T>;
-const auto bg_red = func3<string>;
-
-template<typename T>
-const auto func4 = dye::bright_white_on_green<T>;
-const auto bg_green = func4<string>;
-
-template<typename T>
-const auto func5 = dye::vanilla<T>;
-const auto bg_default = func5<string>;
+constexpr ansi::style bg_blue = ansi::bright_white_on_blue;
+constexpr ansi::style bg_white = ansi::black_on_bright_white;
+constexpr ansi::style bg_red = ansi::bright_white_on_red;
+constexpr ansi::style bg_green = ansi::bright_white_on_green;
+constexpr ansi::style bg_default = ansi::vanilla;
 
 struct ProductInfo {
     int productId;
@@ -56,31 +111,522 @@ struct ProductInfo {
     double productPrice;
 };
 
+// a json file read into memory, the strings of a DOM parsed
+// in-situ point into this buffer
+struct FileBuffer {
+    unique_ptr<char[]> data;
+    size_t length = 0;
+};
+
+// added to a stock counter of a snapshot being replaced, once its stock has
+// been moved to the next snapshot. A sealed counter is never changed again
+constexpr int64_t STOCK_SEALED = int64_t(1) << 40;
+
+// what came of taking a quantity out of the stock of a snapshot
+enum ReserveResult { RESERVED, NOT_ENOUGH_STOCK, SNAPSHOT_REPLACED };
+
+// a version of a parsed catalog file, never changed once it is published.
+// A restock or price change in the file publishes a new snapshot. The
+// products are kept as columns indexed by their position in the file, so
+// they are read without member lookups, and found by id with a binary
+// search. The DOM of the file and its buffer are let go once the columns
+// are built
+struct CatalogSnapshot {
+    Document head;                  // the members of the file but "version" and "products"
+    Document extra;                 // the members of each product but id, name, quantity and
+                                    // price, an object per product. Null if none has any
+    // stock of every product, changed with atomic operations only. Sealed
+    // when the snapshot is replaced, the sales go on in the next snapshot
+    unique_ptr<atomic<int64_t>[]> stock;
+    vector<int> id;
+    vector<SizeType> byId;          // the positions ordered by id, empty if the file is
+                                    // ordered by id already
+    vector<double> price;
+    vector<uint32_t> nameOffset;    // where the name of each product starts in names
+    string names;                   // every name ended with '\0'
+    SizeType size = 0;
+
+    const char * name(SizeType index) const { return names.data() + nameOffset[index]; }
+
+    // the position of the product with an id, size if there is none
+    SizeType find(int productId) const {
+        if (byId.empty()) {
+            auto it = lower_bound(id.begin(), id.end(), productId);
+
+            return it != id.end() && *it == productId ? it - id.begin() : size;
+        }
+
+        auto it = lower_bound(byId.begin(), byId.end(), productId,
+                              [this](SizeType index, int value) { return id[index] < value; });
+
+        return it != byId.end() && id[*it] == productId ? *it : size;
+    }
+
+    // the stock of a product, without the seal of a replaced snapshot
+    int quantity(SizeType index) const {
+        int64_t stocked = stock[index].load(memory_order_relaxed);
+
+        return (int) (stocked >= STOCK_SEALED / 2 ? stocked - STOCK_SEALED : stocked);
+    }
+};
+
+// a catalog kept in memory. Readers take the current snapshot without any
+// lock, the rest is changed by the writers under catalogLock
+struct CatalogCacheEntry {
+    string filepath;
+    atomic<CatalogSnapshot *> current{nullptr};
+    // version of the file and the stock it holds, the stock sold since then
+    // is what has to be taken from the file when another process wrote it
+    long version = 0;
+    unique_ptr<int[]> baseline;
+    atomic<bool> dirty{false};      // stock changed since it was written to the file
+    atomic<bool> writing{false};    // being written, don't take the new file as a change
+    // modified time and size of the file when it was loaded or written
+    atomic<filesystem::file_time_type::rep> modifiedTime{0};
+    atomic<uintmax_t> fileSize{0};
+};
+
+// the entries of catalog cache keyed by file path, published like a snapshot
+// so the readers find a catalog without any lock. The entries are never freed
+typedef map<string, CatalogCacheEntry *> CatalogIndex;
+atomic<const CatalogIndex *> catalogCache{new CatalogIndex};
+list<CatalogCacheEntry> catalogEntries;
+
+// a pointer being read by a thread, what it points to is not freed while
+// the slot holds it (hazard pointer)
+struct HazardSlot {
+    atomic<const void *> pointer{nullptr};
+    atomic<bool> used{false};
+    HazardSlot * next = nullptr;
+};
+
+// the hazard slots of every thread, never freed, and the objects replaced by
+// the writers that are freed once no slot holds them, guarded by catalogLock
+struct {
+    atomic<HazardSlot *> slots{nullptr};
+    vector<pair<const void *, void (*)(const void *)>> retired;
+} hazards;
+
+// the hazard slots taken by a thread that none of its readers is using,
+// given back to every thread when the thread exits
+struct HazardCache {
+    vector<HazardSlot *> free;
+
+    ~HazardCache();
+};
+
+thread_local HazardCache hazardCache;
+
+// the current snapshot of a catalog, held by the reading thread until destroyed
+struct CatalogReader {
+    HazardSlot * slot;
+    const CatalogSnapshot * snapshot;
+
+    CatalogReader(const CatalogCacheEntry &);
+    CatalogReader(const CatalogReader &) = delete;
+    ~CatalogReader();
+
+    const CatalogSnapshot * operator->() const { return snapshot; }
+    const CatalogSnapshot & operator*() const { return *snapshot; }
+};
+
+// a category found in the catalog folder when the program started
+struct CatalogCategory {
+    string name;    // the name of the catalog file, e.g. biscuit
+    string title;   // the "category" of the catalog, shown in the menu
+};
+
+// the valid catalogs loaded at startup, sorted by name
+vector<CatalogCategory> catalogCategories;
+
+// every catalog file must have this shape, the pages and the stock
+// take the members for granted once a catalog is loaded
+const char catalogSchema[] = R"({
+    "type": "object",
+    "required": ["category", "products"],
+    "properties": {
+        "version": {"type": "integer", "minimum": 0},
+        "category": {"type": "string"},
+        "products": {
+            "type": "array",
+            "items": {
+                "type": "object",
+                "required": ["id", "name", "quantity", "price"],
+                "properties": {
+                    "id": {"type": "integer", "minimum": 1, "maximum": 2147483647},
+                    "name": {"type": "string"},
+                    "quantity": {"type": "integer", "minimum": 0, "maximum": 2147483647},
+                    "price": {"type": "number", "minimum": 0}
+                }
+            }
+        }
+    }
+})";
+
+// taken by the writers of the catalog cache, when a catalog is loaded,
+// its stock is written or its file stamp is updated. Never by readers
+mutex catalogLock;
+
+// a write of a file waiting for the persister, it returns false if
+// the file couldn't be written and has to be tried again later
+struct PersistJob {
+    function<bool()> write;
+    chrono::steady_clock::time_point due;   // the file is written by then
+    long ticket;                            // the number the write was queued with
+};
+
+// how far the writes of one file have got, a barrier waits for the
+// ticket its file was last queued with
+struct PersistProgress {
+    long queued = 0;                // ticket of the last write queued
+    long written = 0;               // the writes up to this ticket are done
+    long failed = 0;                // the write of this ticket failed
+};
+
+// writes the files changed by the pages in the background, keyed by file
+// path. A file queued again before it's written is only written once, with
+// the state it has by then
+struct {
+    mutex lock;
+    condition_variable wake;        // a write is due, a barrier waits or stopping
+    condition_variable written;     // a round of writes has finished
+    map<string, PersistJob> pending;
+    map<string, PersistProgress> files;
+    thread worker;
+    long queued = 0;                // writes queued so far, the last ticket
+    bool stopping = false;
+    bool stopped = false;           // writes are done by the caller now
+} persister;
+
+// quantity and unit price of each line of a cart, line i of the "cart"
+// array is entry i of both columns
+struct CartColumns {
+    vector<int> quantity;
+    vector<double> price;
+};
+
+// sums up quantity * price over count lines of a cart
+typedef double (*CartTotalKernel)(const int *, const double *, size_t);
+
+// cart of one user, rebuilt from the snapshot in data/carts/<userid>.json
+// plus the records appended to data/carts/<userid>.log since the snapshot
+struct CartShard {
+    string userid;
+    Document doc;
+    CartColumns columns;       // the lines of the DOM as columns, summed by cartTotal
+    long generation = 0;       // generation of the snapshot the DOM is based on
+    streamoff logOffset = 0;   // bytes of the journal already applied
+    size_t logRecords = 0;     // records applied since the snapshot
+    bool loaded = false;
+    set<string> catalogs;      // catalog files the cart took stock from, its payment waits for their writes
+    mutex lock;
+    atomic<bool> compacting{false};
+};
+
+// cart shards of the users seen by this process, keyed by userid. The
+// lock only guards the map, each shard is changed under its own lock
+struct {
+    unordered_map<string, unique_ptr<CartShard>> shards;
+    bool migrated = false;
+    mutex lock;
+} cartStore;
+
+struct Credential {
+    string userid;
+    string username;
+    string password;
+};
+
+// credentials file loaded once into an open addressing hash table
+// keyed by username, reloaded only when the file has been changed
+struct {
+    vector<Credential> records;     // in file order, the index is the slot in file
+    vector<int> slots;          // index into records, -1 for an empty slot
+    filesystem::file_time_type modifiedTime;
+    uintmax_t fileSize = 0;
+    long revision = 0;          // records rewritten in place when the file was read
+    bool loaded = false;
+} credentialStore;
+
+// exclusive lock on a file shared between processes, held until destroyed
+struct FileLock {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    int fd;
+#endif
+
+    FileLock(const char *);
+    ~FileLock();
+};
+
 struct{
     string userid;
     string username;
     string password;
 } loginInfo;
 
+// a product of a batch order
+struct BatchItem {
+    string category;
+    int productId;
+    int quantity;
+};
+
+// an order read from a batch file, parsed and validated
+struct BatchOrder {
+    long line;
+    string userid;
+    vector<BatchItem> items;
+    string error;           // why the order is rejected, empty if valid
+};
+
+// text of the screen being composed by a page, written to the
+// terminal in one go when the page waits for input
+struct FrameBuffer : streambuf {
+    string text;
+
+    int overflow(int c) override {
+        if (c != EOF)
+            text.push_back(c);
+        return c;
+    }
+
+    streamsize xsputn(const char * s, streamsize n) override {
+        text.append(s, n);
+        return n;
+    }
+
+    // called when cin flushes its tied stream before reading
+    int sync() override;
+};
+
+FrameBuffer frameBuffer;
+ostream frame(&frameBuffer);
+
+enum Align { ALIGN_LEFT, ALIGN_RIGHT };
+enum ColumnType { INT_COLUMN, STRING_COLUMN, DOUBLE_COLUMN };
+
+// a column of the table displayed by displayTable
+struct Column {
+    const char * title;
+    int width;              // space used inside the column
+    Align align;
+    const char * key;       // key of the value in json
+    SizeType keyLength;
+    ColumnType type;
+};
+
+constexpr Column NO_COLUMN     = {"No.",    3,  ALIGN_LEFT,  "id",       2, INT_COLUMN};
+constexpr Column ITEM_COLUMN   = {"Item",   30, ALIGN_LEFT,  "name",     4, STRING_COLUMN};
+constexpr Column QTY_COLUMN    = {"Qty",    4,  ALIGN_RIGHT, "quantity", 8, INT_COLUMN};
+constexpr Column PRICE_COLUMN  = {"Price",  6,  ALIGN_RIGHT, "price",    5, DOUBLE_COLUMN};
+constexpr Column AMOUNT_COLUMN = {"Amount", 6,  ALIGN_RIGHT, "amount",   6, DOUBLE_COLUMN};
+
+/**
+ * @brief  Sum the space used by the columns of a table
+ * @param  columns  The columns of the table
+ * @return  The space used by all columns
+ */
+template <size_t N>
+constexpr int tableWidth(const Column (&columns)[N]) {
+    int usedSpace = 0;
+
+    for (const Column & column : columns)
+        usedSpace += column.width;
+
+    return usedSpace;
+}
+
+// every page returns the page to be displayed next
+enum Page {
+    WELCOME_PAGE,
+    LOGIN_PAGE,
+    SIGNUP_PAGE,
+    MAIN_PAGE,
+    MENU_PAGE,
+    ACCOUNT_PAGE,
+    CART_PAGE,
+    PRODUCT_PAGE,
+    PAYMENT_PAGE,
+    RECEIPT_PAGE,
+    EXIT_PAGE
+};
+
+// category shown by the product page, the name of its catalog file
+string currentCategory;
+// index of the first product row shown by the product page
+SizeType productOffset = 0;
+
+// connection to the server when running as a lane, -1 if the
+// catalogs, carts and credentials are kept by this process
+int laneSocket = -1;
+
+// the state shared by the lanes of a server, catalogs are read from
+// snapshots and their stock changed by atomic counters
+struct {
+    mutex credentials;
+} serverLocks;
+
+#ifdef SUPERMARKET_BENCH
+// every allocation of the program is counted, so the benchmarks
+// can report the allocations made by each operation
+atomic<size_t> benchAllocations{0};
+
+// the frames presented to the terminal, their bytes and the writes they took
+size_t benchFrames = 0;
+size_t benchFrameBytes = 0;
+size_t benchFrameWrites = 0;
+
+void * operator new(size_t size) {
+    benchAllocations.fetch_add(1, memory_order_relaxed);
+
+    if (void * memory = malloc(size ? size : 1))
+        return memory;
+
+    throw bad_alloc();
+}
+
+// kept out of line, otherwise gcc sees memory from operator new given to
+// free and warns about a mismatched deallocation
+[[gnu::noinline]] void operator delete(void * memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void * memory, size_t) noexcept {
+    operator delete(memory);
+}
+#endif
+
 // Pages
-void welcomePage();
-void loginPage();
-void signupPage();
-void mainPage();
-void menuPage();
-void accountPage();
-void cartPage();
-void productPage(string);
-void paymentPage();
-void receiptPage();
+Page welcomePage();
+Page loginPage();
+Page signupPage();
+Page mainPage();
+Page menuPage();
+Page accountPage();
+Page cartPage();
+Page productPage();
+Page paymentPage();
+Page receiptPage();
+
+// Headless driver
+int runScript(const char *);
+double percentile(vector<double> &, double);
+int runBatch(const char *);
+void batchParseOrder(const string &, BatchOrder &, const unordered_set<string> &);
+bool batchCommitOrder(BatchOrder &, map<string, CatalogCacheEntry *> &, ostream &);
+#ifdef SUPERMARKET_BENCH
+int runBench(int);
+#endif
+
+// Store, kept by this process or by the server of the lanes
+bool storeLogin(const string &, const string &);
+string storeSignup(const string &, const string &);
+bool storeUpdateAccount(const string &, const string &, const string &, const string &);
+vector<CatalogCategory> storeCategories();
+Document & storeCatalogPage(const string &, SizeType, SizeType);
+long storeFindProduct(const string &, int);
+bool storeAddToCart(const string &, const string &, int, int);
+Value & storeCart(const string &);
+double storeCartTotal(const string &);
+void storeRemoveCartLine(const string &, int);
+bool storePay(const string &);
+void storeClearCart(const string &);
+
+// Lanes server
+int runServer(const char *);
+void serveLane(int);
+string serverHandle(const string &, string &);
+CatalogCacheEntry * serverLoadCatalog(const string &);
+bool laneConnect(const char *);
+string laneCall(initializer_list<string>);
 
 // Helper function
+string catalogPath(const string &);
+bool validCategoryName(const string &);
+bool validCredential(const string &, const string &);
+void catalogWindow(const CatalogCacheEntry &, SizeType, SizeType, Document &);
+bool loginUser(const string &, const string &);
+bool addProductToCart(const string &, CatalogCacheEntry &, int, int);
+double cartTotal(const CartColumns &);
+CartTotalKernel cartTotalSelect();
+double cartTotalScalar(const int *, const double *, size_t);
+#ifdef CART_TOTAL_SIMD
+double cartTotalSse2(const int *, const double *, size_t);
+double cartTotalAvx(const int *, const double *, size_t);
+#endif
+string uniquePath(const string &);
 Document readJsonFile(string);
-void writeJsonFile(Document &, string);
-int jsonFindUserPosition(Value &);
-int jsonCreateNewUser(Value &, Document::AllocatorType &);
+bool readJsonFileInsitu(string, Document &, FileBuffer &);
+bool writeJsonFile(Document &, string);
+void persistQueue(const string &, function<bool()>);
+void persistWorker();
+bool persistFlush(const vector<string> &);
+bool persistFlush();
+void persistStop();
+CatalogCacheEntry & loadCatalog(string);
+CatalogCacheEntry * catalogFind(const string &);
+bool catalogPreload();
+vector<string> catalogDiscover();
+bool catalogParse(const string &, Document &, FileBuffer &, string &);
+CatalogCacheEntry & catalogInstall(const string &, const Document &, filesystem::file_time_type, uintmax_t);
+HazardSlot * hazardAcquire();
+void hazardRelease(HazardSlot *);
+template<typename T> T * hazardProtect(HazardSlot *, const atomic<T *> &);
+void hazardRetire(const void *, void (*)(const void *));
+ReserveResult inventoryReserve(CatalogCacheEntry &, const CatalogSnapshot &, SizeType, int);
+void inventoryRelease(CatalogCacheEntry &, int, int);
+void inventoryChanged(CatalogCacheEntry &);
+bool inventoryWrite(CatalogCacheEntry &);
+bool catalogCommit(const string &, CatalogCacheEntry &);
+bool catalogMerge(const string &);
+long readDocumentVersion(const string &);
+int jsonFindUserPosition(Value &, string);
+int jsonCreateNewUser(Value &, string, Document::AllocatorType &);
+CartShard & cartShard(const string &);
+void cartFind(const string &, Document &);
+double cartFindTotal(const string &);
+void cartAddLine(string, const char *, int, double);
+void cartRemoveLine(string, int);
+void cartClear(string);
+void cartTookStock(const string &, const string &);
+vector<string> cartCatalogs(const string &);
+string cartShardPath(const string &, const char *);
+void cartLoadSnapshot(CartShard &);
+void cartReplayLog(CartShard &, bool = false);
+void cartApplyRecord(Value &, CartColumns *, const string &, Document::AllocatorType &);
+string cartEscapeField(const string &);
+string cartUnescapeField(const string &);
+void cartAppendRecord(CartShard &, const string &);
+void cartWriteSnapshot(const string &, const string &, const Value &, long);
+void cartCompact(CartShard *);
+void cartMigrateLegacy();
+void credentialsLoad(bool = false);
+bool credentialsLoadAppended();
+long credentialsRevision();
+void credentialsCountRewrite();
+Credential * credentialsFind(const string &);
+void credentialsInsert(const Credential &);
+void credentialsRename(Credential *, const string &, const string &);
+void credentialsRehash(size_t);
+void credentialsStamp();
+string credentialsSignup(const string &, const string &);
+bool credentialsUpdate(const string &, const string &, const string &, const string &);
+string formatCredential(const Credential &);
+Credential parseCredential(const string &);
+bool credentialsUpgradeFile(const vector<Credential> &);
+long allocateUserid();
+size_t hashUsername(const string &);
+void terminalInit();
+#ifndef _WIN32
+int getch();
+#endif
+void presentFrame();
+void clearScreen();
 void lineDivider(char);
 void margin();
+void pad(int);
 void countSpaceBetween(int, int, int*, int*, int);
 
 /** 
@@ -90,8 +636,7 @@ void countSpaceBetween(int, int, int*, int*, int);
  * @param  border  Decide whether to show the border of the left and right side of the program
  * @param  width   The width of the interface
  */
-template <typename T>
-void printCenter(string text, T (*color)(string), bool border = false, int width = WIDTH + 1) {
+void printCenter(string_view text, const ansi::style & color, bool border = false, int width = WIDTH + 1) {
     int front = 0;
     int back = 0;
 
@@ -100,160 +645,287 @@ void printCenter(string text, T (*color)(string), bool border = false, int width
     if (border) {
         front = width / 2.0 + ceil(text.length() / 2.0);
         back = width - front;
-        cout << '|' << setw(front - 1) << right << color(text) << setw(back - 1) << color(" ") << "|\n";
+        frame << '|' << setw(front - 1) << right << color(text) << setw(back - 1) << color(" ") << "|\n";
     } else {
         front = width / 2.0 + ceil(text.length() / 2.0);
         back = width - front;
-        cout << setw(front) << right << color(text) << setw(back) << color(" ") << '\n';
+        frame << setw(front) << right << color(text) << setw(back) << color(" ") << '\n';
     }
 }
 
 /**
  * @brief  Check the length of credentials not exceed the limit and 
- *         make sure doesn't have blank space
+ *         make sure doesn't have blank space or comma
  * @param  credentials  The credentials that need to be checked
- * @param  page         Page to be display after error message showed
+ * @return  False if error message showed
  */
 template <typename T, size_t N>
-void checkCredentials(T (&credentials)[N], void (*page)()) {
+bool checkCredentials(T (&credentials)[N]) {
     string credentials_type = sizeof(credentials) == 13 ? "Username" : "Password";
     string credentials_size = to_string(sizeof(credentials) - 1);
 
     // check if the length of credentials is longer than the limit?
     if (sizeof(credentials) <= strlen(credentials)) {
-            system("cls||clear");
+            clearScreen();
             printCenter(credentials_type + " cannot exceed " + credentials_size + " characters", bg_red);            
-            page();
+            return false;
     }
 
     // loop each char in credentials to check if found any blank character
     for (int i = 0; i < strlen(credentials); i++) {
         if (isspace(credentials[i])) {
-            system("cls||clear");
+            clearScreen();
             printCenter(credentials_type + " cannot contain blank", bg_red);
-            page();
+            return false;
         }
     }
+
+    // comma separates the fields of credentials file
+    if (strchr(credentials, ',') != nullptr) {
+        clearScreen();
+        printCenter(credentials_type + " cannot contain comma", bg_red);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief  Get the value of a column from a row of table. The position of
+ *         the member found in the previous row is tried first, since the
+ *         rows of a json file keep the same order of keys
+ * @param  row     A json object of the table
+ * @param  column  The column of the value
+ * @param  hint    The position of the member in the previous row
+ * @return  The value of the column
+ */
+inline const Value & columnValue(const Value & row, const Column & column, SizeType & hint) {
+    if (hint < row.MemberCount()) {
+        const Value & name = (row.MemberBegin() + hint)->name;
+
+        if (name.GetStringLength() == column.keyLength &&
+            memcmp(name.GetString(), column.key, column.keyLength) == 0)
+            return (row.MemberBegin() + hint)->value;
+    }
+
+    Value::ConstMemberIterator member = row.FindMember(Value(StringRef(column.key, column.keyLength)));
+
+    hint = member - row.MemberBegin();
+
+    return member->value;
 }
 
 /**
- * @brief  Display products in a table form with specify headers
- * @param  headers     The headers of the table
+ * @brief  Display products in a table form with specify columns
+ * @param  columns     The columns of the table
  * @param  data        The data tha need to be display in the cells of table
- * @param  alloc       The allocator of a DOM of a json
- * @param  printTotal  Print the total amount in the last column of table
+ * @param  first       Index of the first row to display
+ * @param  count       Maximum number of rows to display, only these rows are visited
  */
 template <size_t N>
-void displayTable(string (&headers)[N], Value & data, Document::AllocatorType & alloc, bool printTotal) {
+void displayTable(const Column (&columns)[N], const Value & data,
+                  SizeType first = 0, SizeType count = numeric_limits<SizeType>::max()) {
     int averageSpace = 0;
     int lastSpace = 0;
-    int usedSpace = 0;
     int intervals = N + 1;
-    int space = 0;
-    double totalAmount = 0.0;
-
-    map<string, int> tableMap;
-    map<string, string> jsonMap;
-
-    // key value pair of header names with its 
-    // space used inside a column of table
-    tableMap["No."] = 3;
-    tableMap["Item"] = 30;
-    tableMap["Qty"] = 4;
-    tableMap["Price"] = 6;
-    tableMap["Amount"] = 6;
+    SizeType hints[N] = {};
 
-    // map between the value of header names that 
-    // displayed on screen with the keys in json
-    jsonMap["No."] = "id";
-    jsonMap["Item"] = "name";
-    jsonMap["Qty"] = "quantity";
-    jsonMap["Price"] = "price";
-    jsonMap["Amount"] = "amount";
-
-    for (int i = 0; i < N; i++)
-        usedSpace += tableMap[headers[i]];
-
-    countSpaceBetween(usedSpace, intervals, &averageSpace, &lastSpace, WIDTH);
+    countSpaceBetween(tableWidth(columns), intervals, &averageSpace, &lastSpace, WIDTH);
 
     margin();
-    cout << "|";
+    frame << "|";
 
     // loop to display the header names
-    int i = 0;
-    while (i < N) {
-        space = tableMap[headers[i]];
-
-        cout << string(averageSpace, ' ') << setw(tableMap[headers[i]]);
-
-        if (space == 3 || space == 30)
-            cout << left << headers[i];
-        else if (space == 4 || space == 6)
-            cout << right << headers[i];
-        i++;
+    for (const Column & column : columns) {
+        pad(averageSpace);
+        frame << setw(column.width) << (column.align == ALIGN_LEFT ? left : right) << column.title;
     }
     
-    cout << string(lastSpace, ' ') << "|\n";
+    pad(lastSpace);
+    frame << "|\n";
     lineDivider('-');
     margin(); 
-    cout << setw(WIDTH) << left << "|" << "|\n";
+    frame << setw(WIDTH) << left << "|" << "|\n";
     
+    SizeType last = data.Size();
+
+    if (first > last)
+        first = last;
+    if (count < last - first)
+        last = first + count;
+
     // loop to display the data in table
-    for (const auto & p: data.GetArray()) {
-        margin(); 
-        cout << "|";
+    for (SizeType row = first; row < last; row++) {
+        const Value & p = data[row];
 
-        int i = 0;
-        while (i < N) {
-            string header1 = jsonMap[headers[i]];
-            Value header(header1.c_str(), alloc);
+        margin(); 
+        frame << "|";
 
-            space = tableMap[headers[i]];
+        for (size_t i = 0; i < N; i++) {
+            const Column & column = columns[i];
+            const Value & value = columnValue(p, column, hints[i]);
 
-            cout << string(averageSpace, ' ') << setw(space);
+            pad(averageSpace);
+            frame << setw(column.width) << (column.align == ALIGN_LEFT ? left : right);
 
-            switch (space) {
-                case 3:
-                    cout << left << p[header].GetInt();
+            switch (column.type) {
+                case INT_COLUMN:
+                    frame << value.GetInt();
                     break;
-                case 30:
-                    cout << left << p[header].GetString();
+                case STRING_COLUMN:
+                    frame << value.GetString();
                     break;
-                case 4:
-                    cout << right << p[header].GetInt();
-                    break;
-                case 6:
-                    cout << right << fixed << setprecision(2) << p[header].GetDouble();
+                case DOUBLE_COLUMN:
+                    frame << fixed << setprecision(2) << value.GetDouble();
                     break;
             }
-            i++;
         }
-        cout << string(lastSpace, ' ') << "|\n";
-
-        if (printTotal)
-            totalAmount += p["amount"].GetDouble();
+        pad(lastSpace);
+        frame << "|\n";
     }
 
     margin(); 
-    cout << setw(WIDTH) << left << "|" << "|\n";
+    frame << setw(WIDTH) << left << "|" << "|\n";
     lineDivider('-');
+}
 
-    // display the total amount if printTotal set to true
-    if (printTotal) {
-        margin();
-        cout << setw(16) << left << "|   Total Amount"
-            << setw(WIDTH - 16 - lastSpace) << right << totalAmount
-            << string(lastSpace, ' ') << "|\n";
-        lineDivider('-');
+/**
+ * @brief  Display the total amount below a table, in the last column of table
+ * @param  columns      The columns of the table
+ * @param  totalAmount  The total amount of the rows of table
+ */
+template <size_t N>
+void displayTotal(const Column (&columns)[N], double totalAmount) {
+    int averageSpace = 0;
+    int lastSpace = 0;
+
+    countSpaceBetween(tableWidth(columns), N + 1, &averageSpace, &lastSpace, WIDTH);
+
+    margin();
+    frame << setw(16) << left << "|   Total Amount"
+        << setw(WIDTH - 16 - lastSpace) << right << fixed << setprecision(2) << totalAmount
+        << string(lastSpace, ' ') << "|\n";
+    lineDivider('-');
+}
+
+/**
+ * @brief  Write the composed frame to the terminal with a single write
+ *         and start composing the next one
+ */
+void presentFrame() {
+    const char * data = frameBuffer.text.data();
+    size_t size = frameBuffer.text.size();
+
+#ifdef SUPERMARKET_BENCH
+    benchFrames += size > 0;
+    benchFrameBytes += size;
+#endif
+
+#ifdef _WIN32
+    fwrite(data, 1, size, stdout);
+    fflush(stdout);
+#ifdef SUPERMARKET_BENCH
+    benchFrameWrites += size > 0;
+#endif
+#else
+    while (size > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, size);
+#ifdef SUPERMARKET_BENCH
+        benchFrameWrites++;
+#endif
+
+        if (written <= 0)
+            break;
+
+        data += written;
+        size -= written;
+    }
+#endif
+
+    // keep the capacity for the next frame
+    frameBuffer.text.clear();
+}
+
+int FrameBuffer::sync() {
+    presentFrame();
+    return 0;
+}
+
+/**
+ * @brief  Clear the terminal before the next page is displayed. The escape
+ *         sequences become part of the next frame, so the terminal clears
+ *         and redraws in one write
+ */
+void clearScreen() {
+    frame << ANSI_CURSOR_HOME << ANSI_CLEAR_SCREEN << ANSI_CLEAR_SCROLLBACK;
+}
+
+/**
+ * @brief  Prepare the terminal to understand ANSI escape sequences
+ */
+void terminalInit() {
+#ifdef _WIN32
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+    HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode = 0;
+
+    if (GetConsoleMode(console, &mode))
+        SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+#endif
+}
+
+#ifndef _WIN32
+/**
+ * @brief  Read a key without waiting for Enter and without echoing it,
+ *         like getch of conio.h on Windows
+ * @return  The key read, or EOF
+ */
+int getch() {
+    struct termios saved;
+    bool terminal = tcgetattr(STDIN_FILENO, &saved) == 0;
+
+    // input that is not a terminal, exp: a script piped in, is read as is
+    if (terminal) {
+        struct termios raw = saved;
+
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
     }
+
+    int key = getchar();
+
+    if (terminal)
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+
+    return key;
 }
+#endif
 
 /**
  * @brief  Provide a specify left margin for the interface
  *         so it will not stick on the left side of console
  */
 void margin() {
-    cout << string(25, ' ');
+    pad(25);
+}
+
+/**
+ * @brief  Fill the frame with blank space without building a string
+ * @param  count  The number of blank space
+ */
+void pad(int count) {
+    static const char blanks[] = "                                ";
+
+    while (count > 0) {
+        int length = min(count, (int)sizeof(blanks) - 1);
+
+        frame.write(blanks, length);
+        count -= length;
+    }
 }
 
 /**
@@ -262,356 +934,343 @@ void margin() {
  */
 void lineDivider(char symbol) {
     margin();
-    cout << string(WIDTH + 1, symbol) << '\n';
+    frame << string(WIDTH + 1, symbol) << '\n';
 }
 
-int main() {
-    welcomePage();
-    
-    system("exit");
+// pages indexed by the Page enum
+Page (*const pages[])() = {
+    welcomePage,
+    loginPage,
+    signupPage,
+    mainPage,
+    menuPage,
+    accountPage,
+    cartPage,
+    productPage,
+    paymentPage,
+    receiptPage
+};
+
+int main(int argc, char * argv[]) {
+    Page page = WELCOME_PAGE;
+
+    // run the shopper actions of a script instead of the interface
+    if (argc == 3 && strcmp(argv[1], "--script") == 0)
+        return runScript(argv[2]);
+
+    // check out the orders of a batch file instead of the interface
+    if (argc == 3 && strcmp(argv[1], "--batch") == 0)
+        return runBatch(argv[2]);
+
+    // keep the data for the lanes, or run the interface as a lane of a server
+    if (argc >= 2 && strcmp(argv[1], "--server") == 0)
+        return runServer(argc == 3 ? argv[2] : SERVER_SOCKET_PATH);
+    if (argc >= 2 && strcmp(argv[1], "--lane") == 0 && !laneConnect(argc == 3 ? argv[2] : SERVER_SOCKET_PATH))
+        return 1;
+
+#ifdef SUPERMARKET_BENCH
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0)
+        return runBench(argc == 3 ? atoi(argv[2]) : 10000);
+#endif
+
+    // a lane browses the catalogs of its server
+    if (laneSocket < 0 && !catalogPreload()) {
+        cerr << "Press Enter to continue without the invalid catalogs";
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+
+    terminalInit();
+
+    // every read from cin presents the frame composed so far
+    cin.tie(&frame);
+
+    // display the pages one after another instead of calling each other,
+    // so the stack doesn't grow with every screen. Stop when input ended
+    while (page != EXIT_PAGE && cin)
+        page = pages[page]();
+
+    presentFrame();
 }
 
-void welcomePage() {
+Page welcomePage() {
     char option;
 
-    cout << '\n';
+    frame << '\n';
     lineDivider('*');
     printCenter("Welcome to Tesco Supermarket", bg_blue);
     lineDivider('*');
     margin(); 
-    cout << setw(WIDTH) << left << "|" << "|\n";
+    frame << setw(WIDTH) << left << "|" << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|     1. Login"  << "|\n";
+    frame << setw(WIDTH) << left << "|     1. Login"  << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|     2. Signup" << "|\n";
+    frame << setw(WIDTH) << left << "|     2. Signup" << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|     3. Quit" << "|\n";
+    frame << setw(WIDTH) << left << "|     3. Quit" << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|" << "|\n";
+    frame << setw(WIDTH) << left << "|" << "|\n";
     lineDivider('='); 
-    cout << '\n';
+    frame << '\n';
     margin(); 
-    cout << "   Enter your choice: ";
+    frame << "   Enter your choice: ";
     cin  >> option;
     
-    system("cls||clear");
+    clearScreen();
 
     switch (option) {
         case '1': 
-            loginPage(); 
-            break;
+            return LOGIN_PAGE;
         case '2': 
-            signupPage(); 
-            break;
+            return SIGNUP_PAGE;
         case '3':
-            exit(0);
-            break;
+            return EXIT_PAGE;
         default: 
             printCenter("Invalid option", bg_red);
-            welcomePage(); 
-            break;
+            return WELCOME_PAGE;
     }
 }
 
-void loginPage() {
-    string storeUserid;
-    string storeUsername;
-    string storePassword;
+Page loginPage() {
     string username;
     string password;
-    string line, word;
 
-    cout << '\n';
+    frame << '\n';
     lineDivider('*');
     printCenter("Login Page", bg_blue);
     lineDivider('*'); 
-    cout << '\n';
+    frame << '\n';
     margin(); 
-    cout << "     Username : ";
+    frame << "     Username : ";
     cin  >> username;
     margin(); 
-    cout << "     Password : ";
+    frame << "     Password : ";
     cin  >> password;
 
-    fstream file(CREDENTIALS_FILE_PATH, ios::in);
-
-    if (file.is_open()) {
-        getline(file, line);
-
-        while (getline(file, line)) {
-            stringstream str(line);
-
-            getline(str, storeUserid, ',');
-            getline(str, storeUsername, ',');
-            getline(str, storePassword, ',');
-
-            if (storeUsername == username && storePassword == password) {
-                loginInfo = {storeUserid, storeUsername, storePassword};
-
-                system("cls||clear");
-                printCenter("Login Successfully!", bg_green);
-                mainPage();
-            }
-        }
-        file.close();
+    if (storeLogin(username, password)) {
+        clearScreen();
+        printCenter("Login Successfully!", bg_green);
+        return MAIN_PAGE;
     }
 
-    system("cls||clear");
+    clearScreen();
     printCenter("Invalid username or password, please try again.", bg_red);
-    welcomePage();
+    return WELCOME_PAGE;
 }
 
-void signupPage() {
-    int numOfLine = 1;
-    string line, word;
+Page signupPage() {
     string newUserid;
     char newUsername[13];
     char newPassword[9];
 
-    cout << '\n';
+    frame << '\n';
     lineDivider('*');
     printCenter("Signup Page", bg_blue);
     lineDivider('*'); 
-    cout << '\n';
+    frame << '\n';
     margin(); 
-    cout << "     New username : ";
+    frame << "     New username : ";
     cin.ignore();
     cin.getline(newUsername, 256);
-    checkCredentials(newUsername, &signupPage);
+    if (!checkCredentials(newUsername))
+        return SIGNUP_PAGE;
 
     margin(); 
-    cout << "     New password : ";
+    frame << "     New password : ";
     cin.getline(newPassword, 256);
-    checkCredentials(newPassword, &signupPage);
-
-    fstream file(CREDENTIALS_FILE_PATH, ios::in);
+    if (!checkCredentials(newPassword))
+        return SIGNUP_PAGE;
 
-    if (file.is_open()) {
-        getline(file, line);
+    newUserid = storeSignup(newUsername, newPassword);
 
-        while (getline(file, line)) {
-            stringstream str(line);
-
-            while (getline(str, word, ',')) {
-                if (newUsername == word) {
-                    system("cls||clear");
-                    printCenter("Username already exist", bg_red);
-                    signupPage();
-                }    
-            }
-            // get the number of line in the credentials txt file
-            // as the new id for new user
-            numOfLine++; 
-        }
-        file.close();
+    if (newUserid.empty()) {
+        clearScreen();
+        printCenter("Username already exist", bg_red);
+        return SIGNUP_PAGE;
     }
 
-    // open and append the new signup user information 
-    // to the credentials txt file
-    fstream file2(CREDENTIALS_FILE_PATH, ios::app);
-    newUserid = to_string(numOfLine);
-
-    file2 << "\n" 
-          << newUserid << ','
-          << newUsername << ','
-          << newPassword;
-    file2.close();
-
     loginInfo = {newUserid, newUsername, newPassword};
 
-    system("cls||clear");
+    clearScreen();
     printCenter("Account set up successfully", bg_green);
-    mainPage();
+    return MAIN_PAGE;
 }
 
-void mainPage() {
+Page mainPage() {
     char option;
 
-    cout << '\n';
+    frame << '\n';
     lineDivider('*');
     printCenter("Main Page", bg_blue);
     lineDivider('*');
     margin(); 
-    cout << setw(WIDTH) << left << "|" << "|\n";
+    frame << setw(WIDTH) << left << "|" << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|     1. Menu"    << "|\n";
+    frame << setw(WIDTH) << left << "|     1. Menu"    << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|     2. Account" << "|\n";
+    frame << setw(WIDTH) << left << "|     2. Account" << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|     3. Cart"    << "|\n";
+    frame << setw(WIDTH) << left << "|     3. Cart"    << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|     4. Logout"  << "|\n";
+    frame << setw(WIDTH) << left << "|     4. Logout"  << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|" << "|\n";
+    frame << setw(WIDTH) << left << "|" << "|\n";
     lineDivider('='); 
-    cout << '\n';
+    frame << '\n';
     margin(); 
-    cout << "   Enter your choice: ";
+    frame << "   Enter your choice: ";
     cin  >> option;
 
-    system("cls||clear");
+    clearScreen();
 
     switch (option) {
         case '1': 
-            menuPage(); 
-            break;
+            return MENU_PAGE;
         case '2': 
-            accountPage(); 
-            break;
+            return ACCOUNT_PAGE;
         case '3': 
-            cartPage();
-            break;
+            return CART_PAGE;
         case '4': 
-            welcomePage(); 
-            break;
+            return WELCOME_PAGE;
         default: 
             printCenter("Invalid option", bg_red);
-            mainPage(); 
-            break;
+            return MAIN_PAGE;
     }
 }
 
-void menuPage() {
-    char option;
+Page menuPage() {
+    string option;
+    vector<CatalogCategory> categories = storeCategories();
 
-    cout << '\n';
+    frame << '\n';
     lineDivider('*');
     printCenter("Menu Page", bg_blue);
     lineDivider('*');
     margin(); 
-    cout << setw(WIDTH) << left << "|" << "|\n";
-    margin(); 
-    cout << setw(WIDTH) << left << "|   Categories:"            << "|\n";
-    margin(); 
-    cout << setw(WIDTH) << left << "|     1. Biscuit & Cookies" << "|\n";
+    frame << setw(WIDTH) << left << "|" << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|     2. Beverages"         << "|\n";
-    margin(); 
-    cout << setw(WIDTH) << left << "|     3. Health & Beauty"   << "|\n";
+    frame << setw(WIDTH) << left << "|   Categories:"            << "|\n";
+
+    // one line for every catalog found at startup, a long title is cut to the border
+    for (size_t i = 0; i < categories.size(); i++) {
+        string line = "|     " + to_string(i + 1) + ". " + categories[i].title;
+
+        margin(); 
+        frame << setw(WIDTH) << left << line.substr(0, WIDTH - 1) << "|\n";
+    }
+    if (categories.empty()) {
+        margin(); 
+        frame << setw(WIDTH) << left << "|     No category available" << "|\n";
+    }
+
     margin(); 
-    cout << setw(WIDTH) << left << "|" << "|\n";
+    frame << setw(WIDTH) << left << "|" << "|\n";
     lineDivider('-');
     margin(); 
-    cout << setw(WIDTH) << left << "|   Enter (b): Back to previous page" << "|\n";
+    frame << setw(WIDTH) << left << "|   Enter (b): Back to previous page" << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|   Enter (p): Proceed to checkout"  << "|\n";
+    frame << setw(WIDTH) << left << "|   Enter (p): Proceed to checkout"  << "|\n";
     lineDivider('='); 
-    cout << '\n';
+    frame << '\n';
     margin(); 
-    cout << "   Enter your choice: ";
+    frame << "   Enter your choice: ";
     cin  >> option;
 
-    system("cls||clear");
+    clearScreen();
 
-    switch (option) {
-        case '1': 
-            productPage("data/biscuit.json"); 
-            break;
-        case '2': 
-            productPage("data/beverages.json"); 
-            break;
-        case '3': 
-            productPage("data/health.json"); 
-            break;
-        case 'b': 
-            mainPage(); 
-            break;
-        case 'p': 
-            cartPage(); 
-            break;
-        default: 
-            printCenter("Invalid option", bg_red);
-            menuPage();
-            break;
+    // a category is always shown from its first page
+    productOffset = 0;
+
+    if (option == "b")
+        return MAIN_PAGE;
+    if (option == "p")
+        return CART_PAGE;
+
+    size_t selected = 0;
+
+    try {
+        selected = stoul(option);
     }
+    catch (...) {
+        selected = 0;
+    }
+
+    if (selected == 0 || selected > categories.size()) {
+        printCenter("Invalid option", bg_red);
+        return MENU_PAGE;
+    }
+
+    currentCategory = categories[selected - 1].name;
+    return PRODUCT_PAGE;
 }
 
 /**
  * @brief  View information of current logged in user. 
  *         Support to change information.
  */
-void accountPage() {
+Page accountPage() {
     char option;
-    string line, word;
-    string tempCredentials = "";
     char newUsername[13];
     char newPassword[9];
 
-    cout << '\n';
+    frame << '\n';
     lineDivider('*');
     printCenter("Account Page", bg_blue);
     lineDivider('*');
     margin(); 
-    cout << setw(WIDTH) << left << "|" << "|\n";
+    frame << setw(WIDTH) << left << "|" << "|\n";
     margin(); 
-    cout << setw(17) << "|     Username : " << setw(WIDTH - 17) << loginInfo.username << "|\n";
+    frame << setw(17) << "|     Username : " << setw(WIDTH - 17) << loginInfo.username << "|\n";
     margin(); 
-    cout << setw(17) << "|     Password : " << setw(WIDTH - 17) << loginInfo.password << "|\n";
+    frame << setw(17) << "|     Password : " << setw(WIDTH - 17) << loginInfo.password << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|" << "|\n";
+    frame << setw(WIDTH) << left << "|" << "|\n";
     lineDivider('-');
     margin(); 
-    cout << setw(WIDTH) << left << "|     Enter (p): Change account info"   << "|\n";
+    frame << setw(WIDTH) << left << "|     Enter (p): Change account info"   << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|     Enter (b): Back to previous page" << "|\n";
+    frame << setw(WIDTH) << left << "|     Enter (b): Back to previous page" << "|\n";
     lineDivider('='); 
-    cout << '\n';
+    frame << '\n';
     margin(); 
-    cout << "   Enter your choice: ";
+    frame << "   Enter your choice: ";
     cin  >> option;
 
-    fstream fileIn(CREDENTIALS_FILE_PATH, ios::in);
-        
     if (option == 'p') {
         margin();
-        cout << "   Enter new username : ";
+        frame << "   Enter new username : ";
         cin.ignore();
         cin.getline(newUsername, 256);
-        checkCredentials(newUsername, &accountPage);
+        if (!checkCredentials(newUsername))
+            return ACCOUNT_PAGE;
 
         margin();
-        cout << "   Enter new password : ";
+        frame << "   Enter new password : ";
         cin.getline(newPassword, 256);
-        checkCredentials(newPassword, &accountPage);
-
-        // iterate every line in file
-        while (getline(fileIn, line)) {
-            // split the line into multiple words separated by comma
-            stringstream str(line);
-            getline(str, word, ',');
-
-            if (word != loginInfo.userid) {
-                tempCredentials += line + '\n';
-            }
-            else if (word == loginInfo.userid) {
-                tempCredentials += loginInfo.userid + ',' + newUsername + ',' + newPassword + '\n';
-
-                loginInfo.username = newUsername;
-                loginInfo.password = newPassword;
-            }
-
-            for (size_t i = 0; i < 2; i++) 
-                getline(str, word, ',');
+        if (!checkCredentials(newPassword))
+            return ACCOUNT_PAGE;
+
+        // the new username must not belong to another user
+        if (!storeUpdateAccount(loginInfo.username, loginInfo.password, newUsername, newPassword)) {
+            clearScreen();
+            printCenter("Username already exist", bg_red);
+            return ACCOUNT_PAGE;
         }
 
-        fileIn.close();
+        loginInfo.username = newUsername;
+        loginInfo.password = newPassword;
 
-        fstream fileOut(CREDENTIALS_FILE_PATH, ios::out);
-        fileOut << tempCredentials;
-        fileOut.close();
-
-        system("cls||clear");
+        clearScreen();
         printCenter("Account info changed successfully", bg_green);
-        accountPage();
+        return ACCOUNT_PAGE;
     } 
     else if (option == 'b') {
-        system("cls||clear");
-        mainPage();
+        clearScreen();
+        return MAIN_PAGE;
     } 
     else {
-        system("cls||clear");
+        clearScreen();
         printCenter("Invalid option", bg_red);
-        accountPage();
+        return ACCOUNT_PAGE;
     }
 }
 
@@ -620,226 +1279,247 @@ void accountPage() {
  *         User is allow to view and decide whether to
  *         remove product from cart or proceed to checkout.
  */
-void cartPage() {
+Page cartPage() {
     char option; 
 
-    Document doc = readJsonFile(CART_FILE_PATH);
-    Document::AllocatorType & allocator = doc.GetAllocator();
-    
-    // Get the value of "users" key
-    Value & users = doc["users"];
-    int userPosition = jsonFindUserPosition(users);
-
-    // if the username is not exist in the file, create and add a new one
-    if (userPosition == -1) 
-        userPosition = jsonCreateNewUser(users, allocator);
-
-    // Get the value of "cart" key
-    Value & cart = users[userPosition]["cart"];
+    Value & cart = storeCart(loginInfo.userid);
 
-    string headers[] = {"No.", "Item", "Qty", "Price", "Amount"};
+    static constexpr Column columns[] = {NO_COLUMN, ITEM_COLUMN, QTY_COLUMN, PRICE_COLUMN, AMOUNT_COLUMN};
 
-    cout << '\n';
+    frame << '\n';
     lineDivider('*');
     printCenter("Cart Page", bg_blue);
     lineDivider('*');
 
-    displayTable(headers, cart, allocator, true);
+    displayTable(columns, cart);
+    displayTotal(columns, storeCartTotal(loginInfo.userid));
 
     margin(); 
-    cout << setw(WIDTH) << left << "|   Enter (p): Proceed to checkout"   << "|\n";
+    frame << setw(WIDTH) << left << "|   Enter (p): Proceed to checkout"   << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|   Enter (b): Back to previous page" << "|\n";
+    frame << setw(WIDTH) << left << "|   Enter (b): Back to previous page" << "|\n";
     lineDivider('='); 
-    cout << '\n';
+    frame << '\n';
     margin(); 
-    cout << "   Enter number to unselect product: ";
+    frame << "   Enter number to unselect product: ";
     cin  >> option;
 
-    system("cls||clear");
+    clearScreen();
 
     if (option == 'p') {
         // don't allow checkout if no item in cart
         if (cart.Size() == 0) {
             printCenter("Cart has no item, please add one", bg_red);
-            cartPage();
+            return CART_PAGE;
         }
         else
-            paymentPage();
+            return PAYMENT_PAGE;
     }
     else if (option == 'b') {
-        mainPage();
+        return MAIN_PAGE;
     }
     // stoi(&option) convert option from char to int
     else if (stoi(&option) > 0 && stoi(&option) <= cart.Size()) {
         // remove selected product from cart
-        cart.Erase(cart.Begin() + stoi(&option) - 1);
-
-        // reorder the id of each product in cart numerically
-        for (SizeType i = 0; i < cart.Size(); i++) {
-            cart[i]["id"] = i + 1;
-        }
-        writeJsonFile(doc, CART_FILE_PATH);
+        storeRemoveCartLine(loginInfo.userid, stoi(&option));
 
         printCenter("Item has been removed", bg_green);
-        cartPage();
+        return CART_PAGE;
     }
     else {
         printCenter("Invalid option", bg_red);
-        cartPage();
+        return CART_PAGE;
     }
 }
 
 /**
  * @brief  The interface of product page, the page will display 
- *         different category of products based on the given filepath.
- *         User can add product to cart by input option
- * @param  filepath  The path of the file that store the data 
- *                   of particular category
+ *         different category of products based on the category
+ *         chosen in menu page. User can add product to cart by input option
  */
-void productPage(string filepath) {
-    char option;
+Page productPage() {
+    string option;
+    char answer;
     int selectedProductId = 0;
     int selectedProductQty = 0;
 
-    Document doc = readJsonFile(filepath);
-    Document::AllocatorType & allocator = doc.GetAllocator();
+    // only the products of current page are fetched
+    Document * page = &storeCatalogPage(currentCategory, productOffset, PRODUCT_PAGE_ROWS);
+    SizeType productCount = (*page)["size"].GetUint();
+    SizeType pageCount = max<SizeType>(1, (productCount + PRODUCT_PAGE_ROWS - 1) / PRODUCT_PAGE_ROWS);
+
+    // the category may have less products than the remembered page
+    if (productOffset >= productCount && productOffset > 0) {
+        productOffset = (pageCount - 1) * PRODUCT_PAGE_ROWS;
+        page = &storeCatalogPage(currentCategory, productOffset, PRODUCT_PAGE_ROWS);
+    }
 
-    Value & category = doc["category"];
-    Value & products = doc["products"];
+    Value & category = (*page)["category"];
+    Value & products = (*page)["products"];
 
-    string headers[] = {"No.", "Item", "Qty", "Price"};
+    static constexpr Column columns[] = {NO_COLUMN, ITEM_COLUMN, QTY_COLUMN, PRICE_COLUMN};
 
-    cout << '\n';
+    frame << '\n';
     lineDivider('*');
     printCenter(category.GetString(), bg_blue);
     lineDivider('*');
 
-    displayTable(headers, products, allocator, false);
+    // only the rows of current page are rendered, so a large category
+    // costs the same as a small one
+    displayTable(columns, products);
+
+    if (pageCount > 1) {
+        string pageInfo = "|   Page " + to_string(productOffset / PRODUCT_PAGE_ROWS + 1) + " of " + to_string(pageCount);
 
+        margin();
+        frame << setw(WIDTH) << left << pageInfo << "|\n";
+        margin(); 
+        frame << setw(WIDTH) << left << "|   Enter (n): Next page,  (p): Previous page" << "|\n";
+        margin(); 
+        frame << setw(WIDTH) << left << "|   Enter (j): Jump to product ID" << "|\n";
+    }
     margin(); 
-    cout << setw(WIDTH) << left << "|   Enter (b): Back to previous page" << "|\n";
+    frame << setw(WIDTH) << left << "|   Enter (b): Back to previous page" << "|\n";
     lineDivider('='); 
-    cout << '\n';
+    frame << '\n';
     margin(); 
-    cout << "   Enter your choice: ";
+    frame << "   Enter your choice: ";
     cin  >> option;
 
     try {
-        selectedProductId = stoi(&option);
+        selectedProductId = stoi(option);
     }
     catch (...) {
         selectedProductId = 0;
     }
 
-    if (option == 'b') {
-        system("cls||clear"); 
-        menuPage();
+    if (option == "b") {
+        clearScreen(); 
+        return MENU_PAGE;
     }
-    else if (selectedProductId > 0 && selectedProductId <= products.Size()){
-        margin();
-        cout << "   Enter the quantity: ";
-        cin >> selectedProductQty;
-        cout << "\n";
+    else if (option == "n" && pageCount > 1) {
+        if (productOffset + PRODUCT_PAGE_ROWS < productCount)
+            productOffset += PRODUCT_PAGE_ROWS;
 
-        Value & selectedProduct = products[selectedProductId - 1];
-        string name = selectedProduct["name"].GetString();
-        Value productName(name.c_str(), allocator);
-
-        Document doc2 = readJsonFile(CART_FILE_PATH);
-        Document::AllocatorType & allocator2 = doc2.GetAllocator();
-
-        Value & users = doc2["users"];
+        clearScreen();
+        return PRODUCT_PAGE;
+    }
+    else if (option == "p" && pageCount > 1) {
+        productOffset = productOffset > PRODUCT_PAGE_ROWS ? productOffset - PRODUCT_PAGE_ROWS : 0;
 
-        int userPosition = jsonFindUserPosition(users);
-        
-        // if user info not found in json, then create a new user in json
-        if (userPosition == -1) {
-            userPosition = jsonCreateNewUser(users, allocator2);
-        }
+        clearScreen();
+        return PRODUCT_PAGE;
+    }
+    else if (option == "j" && pageCount > 1) {
+        margin();
+        frame << "   Enter the product ID: ";
+        cin >> selectedProductId;
 
-        Value & cart = users[userPosition]["cart"];
-        Value newProduct(kObjectType);
+        clearScreen();
 
-        // add the information of selected product in a key value pair
-        newProduct.AddMember("id", cart.Size() + 1, allocator2);
-        newProduct.AddMember("name", productName, allocator2);
-        newProduct.AddMember("quantity", selectedProductQty, allocator2);
-        newProduct.AddMember("price", selectedProduct["price"].GetDouble(), allocator2);
-        newProduct.AddMember("amount", selectedProduct["price"].GetDouble() * selectedProductQty, allocator2);
+        long index = cin ? storeFindProduct(currentCategory, selectedProductId) : -1;
 
-        // append the product details into the cart array of logged user
-        cart.PushBack(newProduct, allocator2);
+        if (index < 0) {
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            printCenter("Invalid product ID", bg_red);
+            return PRODUCT_PAGE;
+        }
 
-        // decrease the product quantity in store
-        selectedProduct["quantity"] = selectedProduct["quantity"].GetInt() - selectedProductQty;
+        // show the page that contains the product
+        productOffset = index / PRODUCT_PAGE_ROWS * PRODUCT_PAGE_ROWS;
+        return PRODUCT_PAGE;
+    }
+    else if (selectedProductId > 0 && storeFindProduct(currentCategory, selectedProductId) >= 0) {
+        margin();
+        frame << "   Enter the quantity: ";
+        cin >> selectedProductQty;
+        frame << "\n";
+
+        if (!cin || selectedProductQty <= 0) {
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            clearScreen();
+            printCenter("Invalid quantity", bg_red);
+            return PRODUCT_PAGE;
+        }
 
-        writeJsonFile(doc, filepath);
-        writeJsonFile(doc2, CART_FILE_PATH);
+        // another lane may have sold the stock shown on the page
+        if (!storeAddToCart(loginInfo.userid, currentCategory, selectedProductId, selectedProductQty)) {
+            clearScreen();
+            printCenter("Not enough stock", bg_red);
+            return PRODUCT_PAGE;
+        }
     }
     else {
-        system("cls||clear");
+        clearScreen();
         printCenter("Invalid Option", bg_red);
-        productPage(filepath);
+        return PRODUCT_PAGE;
     }
 
     margin();
-    cout << "   Item has been added to cart? Continue to add? [y/n]: ";
-    cin  >> option;
+    frame << "   Item has been added to cart? Continue to add? [y/n]: ";
+    cin  >> answer;
 
-    option = tolower(option);
+    answer = tolower(answer);
 
-    if (option == 'y') {
-        system("cls||clear");
-        productPage(filepath);
-    } 
-    else if (option == 'n') {
-        system("cls||clear");
-        menuPage();
-    } 
-    else {
+    // ask again until the answer is yes or no
+    while (cin && answer != 'y' && answer != 'n') {
         margin();
-        cout << "   Invalid option" << "\n\n";
+        frame << "   Invalid option" << "\n\n";
         margin();
-        cout << "   Item has been added to cart? Continue to add? [y/n]: ";
+        frame << "   Item has been added to cart? Continue to add? [y/n]: ";
+        cin  >> answer;
+
+        answer = tolower(answer);
     }
+
+    clearScreen();
+
+    return answer == 'y' ? PRODUCT_PAGE : MENU_PAGE;
 }
 
-void paymentPage() {
+Page paymentPage() {
     char option;
 
-    cout << '\n';
+    frame << '\n';
     lineDivider('*');
     printCenter("Payment Page", bg_blue);
     lineDivider('*');
     margin(); 
-    cout << setw(WIDTH) << left << "|" << "|\n";
+    frame << setw(WIDTH) << left << "|" << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|     1. Credit Card"    << "|\n";
+    frame << setw(WIDTH) << left << "|     1. Credit Card"    << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|     2. Online Banking" << "|\n";
+    frame << setw(WIDTH) << left << "|     2. Online Banking" << "|\n";
     margin(); 
-    cout << setw(WIDTH) << left << "|" << "|\n";
+    frame << setw(WIDTH) << left << "|" << "|\n";
     lineDivider('-');
     margin(); 
-    cout << setw(WIDTH) << left << "|   Enter (b): Back to main page" << "|\n";
+    frame << setw(WIDTH) << left << "|   Enter (b): Back to main page" << "|\n";
     lineDivider('='); 
-    cout << '\n';
+    frame << '\n';
     margin(); 
-    cout << "   Enter your choice: ";
+    frame << "   Enter your choice: ";
     cin  >> option;
 
-    system("cls||clear");
+    clearScreen();
 
     if (option == '1' || option == '2') {
+        // the stock of the cart is tried again in the background
+        if (!storePay(loginInfo.userid)) {
+            printCenter("Payment failed, please try again", bg_red);
+            return PAYMENT_PAGE;
+        }
+
         printCenter("Payment Successful", bg_green);
-        receiptPage();
+        return RECEIPT_PAGE;
     }
     else if (option == 'b') 
-        mainPage();
+        return MAIN_PAGE;
     else {
         printCenter("Invalid option", bg_red);
-        paymentPage();
+        return PAYMENT_PAGE;
     }
 }
 
@@ -847,7 +1527,7 @@ void paymentPage() {
  * @brief  The design of the supermarket's receipts.
  *         The receipt is print after the user make payment.
  */
-void receiptPage() {
+Page receiptPage() {
     char datetime1[50];
     string datetime2;
 
@@ -859,15 +1539,11 @@ void receiptPage() {
     // convert char array to string
     datetime2 = datetime1;
 
-    Document doc = readJsonFile(CART_FILE_PATH);
-    
-    Value & users = doc["users"];
-    int userPosition = jsonFindUserPosition(users);
-    Value & cart = users[userPosition]["cart"];
+    Value & cart = storeCart(loginInfo.userid);
 
-    string headers[] = {"Qty", "Item", "Amount"};
+    static constexpr Column columns[] = {QTY_COLUMN, ITEM_COLUMN, AMOUNT_COLUMN};
 
-    cout << '\n';
+    frame << '\n';
     lineDivider('*');
     printCenter("Receipt", bg_blue);
     lineDivider('*');
@@ -875,100 +1551,3848 @@ void receiptPage() {
     printCenter("TEL: 043456789", bg_default, true);
     lineDivider('-');
 
-    displayTable(headers, cart, doc.GetAllocator(), true);
+    displayTable(columns, cart);
+    displayTotal(columns, storeCartTotal(loginInfo.userid));
 
     printCenter("THANK YOU!", bg_default, true);
     margin();
-    cout << setw(WIDTH) << left << "|" << "|\n";
+    frame << setw(WIDTH) << left << "|" << "|\n";
     printCenter(datetime2, bg_default, true);
     lineDivider('=');
-    cout << '\n';
+    frame << '\n';
     margin();
-    cout << "   Press any key to back to main page: ";
+    frame << "   Press any key to back to main page: ";
+    presentFrame();
     getch();
 
     // erase all products in user's cart since payment has make
-    cart.Erase(cart.Begin(), cart.Begin() + cart.Size());
-    writeJsonFile(doc, CART_FILE_PATH);
+    storeClearCart(loginInfo.userid);
    
-    system("cls||clear");
-    mainPage();
+    clearScreen();
+    return MAIN_PAGE;
 }
 
 /**
- * @brief  Read a json file and parse it into a DOM(document object model)
- * @param  readPath  The location of a json file
- * @return  The DOM of a json object
- */ 
-Document readJsonFile(string readPath) {
-    fstream file(readPath, ios::in);
-    IStreamWrapper isw(file);
+ * @brief  Run the shopper actions of a script against the catalogs, carts and
+ *         credentials without rendering any screen, then report the throughput
+ *         and the latency percentiles of every kind of action.
+ *         One action per line, blank lines and lines start with '#' are skipped:
+ *           login <username> <password>
+ *           add <category> <product id> <quantity>
+ *           remove <cart item no>
+ *           pay
+ *         The category is the name of catalog file in data folder, e.g. biscuit
+ * @param  scriptPath  The location of the script
+ * @return  The exit status of the program
+ */
+int runScript(const char * scriptPath) {
+    ifstream script(scriptPath);
+
+    if (!script) {
+        cerr << "cannot open script " << scriptPath << '\n';
+        return 1;
+    }
+
+    catalogPreload();
+
+    // latency of every action in microseconds, grouped by the action
+    map<string, vector<double>> latencies;
+    string line;
+    int lineNumber = 0;
+    int failures = 0;
+    double elapsed = 0.0;
+    double revenue = 0.0;
+
+    while (getline(script, line)) {
+        istringstream fields(line);
+        string action;
+        bool succeeded = false;
+
+        lineNumber++;
+
+        if (!(fields >> action) || action[0] == '#')
+            continue;
+
+        auto start = chrono::steady_clock::now();
+
+        if (action == "login") {
+            string username;
+            string password;
+
+            if (fields >> username >> password)
+                succeeded = loginUser(username, password);
+        }
+        else if (action == "add") {
+            string category;
+            int productId = 0;
+            int quantity = 0;
+
+            if (!loginInfo.userid.empty() && fields >> category >> productId >> quantity && quantity > 0) {
+                string filepath = catalogPath(category);
+
+                if (filesystem::exists(filepath))
+                    succeeded = addProductToCart(loginInfo.userid, loadCatalog(filepath), productId, quantity);
+            }
+        }
+        else if (action == "remove") {
+            int itemNo = 0;
+            Document cart;
+
+            if (!loginInfo.userid.empty() && fields >> itemNo && itemNo > 0)
+                cartFind(loginInfo.userid, cart);
 
+            if (cart.IsArray() && itemNo <= (int) cart.Size()) {
+                cartRemoveLine(loginInfo.userid, itemNo);
+                succeeded = true;
+            }
+        }
+        else if (action == "pay") {
+            Document cart;
+
+            if (!loginInfo.userid.empty())
+                cartFind(loginInfo.userid, cart);
+
+            if (cart.IsArray() && cart.Size() > 0) {
+                vector<string> paid = cartCatalogs(loginInfo.userid);
+
+                revenue += cartFindTotal(loginInfo.userid);
+                cartClear(loginInfo.userid);
+                succeeded = persistFlush(paid);
+            }
+        }
+        else {
+            cerr << scriptPath << ':' << lineNumber << ": unknown action " << action << '\n';
+            failures++;
+            continue;
+        }
+
+        double latency = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+        if (!succeeded) {
+            cerr << scriptPath << ':' << lineNumber << ": " << action << " failed\n";
+            failures++;
+        }
+
+        latencies[action].push_back(latency);
+        elapsed += latency;
+    }
+
+    size_t operations = 0;
+
+    for (auto & [action, samples] : latencies)
+        operations += samples.size();
+
+    cout << fixed << setprecision(1)
+         << "operations " << operations << ", failed " << failures
+         << ", elapsed " << elapsed / 1000.0 << " ms, "
+         << (elapsed > 0 ? operations / (elapsed / 1e6) : 0.0) << " ops/sec, "
+         << setprecision(2) << "paid " << revenue << setprecision(1) << "\n\n"
+         << left << setw(10) << "action" << right << setw(10) << "count"
+         << setw(12) << "p50 us" << setw(12) << "p95 us" << setw(12) << "p99 us" << '\n';
+
+    for (auto & [action, samples] : latencies) {
+        cout << left << setw(10) << action << right << setw(10) << samples.size()
+             << setw(12) << percentile(samples, 50)
+             << setw(12) << percentile(samples, 95)
+             << setw(12) << percentile(samples, 99) << '\n';
+    }
+
+    return failures == 0 ? 0 : 1;
+}
+
+/**
+ * @brief  Find the nearest-rank percentile of the samples
+ * @param  samples  The samples, they will be sorted
+ * @param  rank     The percentile between 0 and 100
+ * @return  The sample at the percentile
+ */
+double percentile(vector<double> & samples, double rank) {
+    sort(samples.begin(), samples.end());
+
+    size_t index = (size_t) ceil(rank / 100.0 * samples.size());
+
+    return samples[index > 0 ? index - 1 : 0];
+}
+
+/**
+ * @brief  Check out the orders of a JSON-lines batch file through the same stock
+ *         and receipt logic as the product and receipt pages, one order per line:
+ *           {"userid": "1", "items": [{"category": "biscuit", "id": 2, "quantity": 3}]}
+ *         Orders are read in chunks, the orders of a chunk are parsed and validated
+ *         in parallel, then their stock is committed one by one in file order.
+ *         Receipts are appended to the receipts file, rejected orders are reported
+ * @param  batchPath  The location of the batch file
+ * @return  The exit status of the program
+ */
+int runBatch(const char * batchPath) {
+    ifstream batch(batchPath, ios::binary);
+
+    if (!batch) {
+        cerr << "cannot open batch file " << batchPath << '\n';
+        return 1;
+    }
+
+    // the orders of an invalid catalog are rejected as unknown products
+    catalogPreload();
+
+    // userids known when the batch starts, only read by the parsing threads
+    unordered_set<string> userids;
+
+    credentialsLoad();
+    for (const Credential & credential : credentialStore.records)
+        userids.insert(credential.userid);
+
+    unsigned workers = max(1u, thread::hardware_concurrency());
+    vector<string> lines;
+    vector<BatchOrder> orders;
+    map<string, CatalogCacheEntry *> catalogs;
+    fstream receipts(RECEIPTS_FILE_PATH, ios::out | ios::app | ios::binary);
+    long lineNumber = 0;
+    long accepted = 0;
+    long rejected = 0;
+    auto start = chrono::steady_clock::now();
+
+    while (batch) {
+        lines.clear();
+        orders.clear();
+
+        string line;
+
+        while (lines.size() < BATCH_CHUNK_ORDERS && getline(batch, line)) {
+            lineNumber++;
+
+            if (line.find_first_not_of(" \t\r") == string::npos)
+                continue;
+
+            lines.push_back(move(line));
+            orders.emplace_back();
+            orders.back().line = lineNumber;
+        }
+
+        // every thread parses an interleaved share of the chunk
+        vector<thread> parsers;
+
+        for (unsigned w = 1; w < workers && w < lines.size(); w++) {
+            parsers.emplace_back([&, w] {
+                for (size_t i = w; i < lines.size(); i += workers)
+                    batchParseOrder(lines[i], orders[i], userids);
+            });
+        }
+        for (size_t i = 0; i < lines.size(); i += workers)
+            batchParseOrder(lines[i], orders[i], userids);
+        for (thread & parser : parsers)
+            parser.join();
+
+        // stock is taken in file order, so earlier orders are served first
+        for (BatchOrder & order : orders) {
+            if (order.error.empty() && batchCommitOrder(order, catalogs, receipts)) {
+                accepted++;
+                continue;
+            }
+
+            cerr << batchPath << ':' << order.line << ": " << order.error << '\n';
+            rejected++;
+        }
+
+        // the orders of the chunk are paid, their stock and receipts are on
+        // disk before the next chunk is taken
+        vector<string> paid;
+
+        for (auto & [filepath, catalog] : catalogs)
+            paid.push_back(filepath);
+
+        receipts.flush();
+        if (!persistFlush(paid))
+            cerr << batchPath << ": the stock of the orders up to line " << lineNumber << " is not written yet\n";
+    }
+
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << fixed << setprecision(1)
+         << "orders " << accepted + rejected << ", accepted " << accepted << ", rejected " << rejected
+         << ", elapsed " << elapsed << " s, "
+         << (elapsed > 0 ? (accepted + rejected) / elapsed : 0.0) << " orders/sec\n";
+
+    return rejected == 0 ? 0 : 1;
+}
+
+/**
+ * @brief  Parse and validate an order of batch file, only the data that doesn't
+ *         change during the batch is checked, so it can run on any thread
+ * @param  line     The JSON text of the order
+ * @param  order    The order to fill, its error is set if the order is invalid
+ * @param  userids  The userids of all users
+ */
+void batchParseOrder(const string & line, BatchOrder & order, const unordered_set<string> & userids) {
     Document doc;
-    doc.ParseStream(isw);
 
-    return doc;
+    if (doc.Parse(line.c_str(), line.size()).HasParseError() || !doc.IsObject()) {
+        order.error = "not a JSON object";
+        return;
+    }
+
+    auto userid = doc.FindMember("userid");
+    auto items = doc.FindMember("items");
+
+    if (userid == doc.MemberEnd() || !userid->value.IsString() ||
+        !userids.count(userid->value.GetString())) {
+        order.error = "unknown userid";
+        return;
+    }
+
+    if (items == doc.MemberEnd() || !items->value.IsArray() || items->value.Empty()) {
+        order.error = "order has no items";
+        return;
+    }
+
+    order.userid = userid->value.GetString();
+
+    for (const auto & item : items->value.GetArray()) {
+        // the members of anything but an object can't be looked up
+        if (!item.IsObject()) {
+            order.error = "item needs a category, an id and a positive quantity";
+            return;
+        }
+
+        auto category = item.FindMember("category");
+        auto id = item.FindMember("id");
+        auto quantity = item.FindMember("quantity");
+
+        if (category == item.MemberEnd() || id == item.MemberEnd() ||
+            quantity == item.MemberEnd() || !category->value.IsString() ||
+            !id->value.IsInt() || !quantity->value.IsInt() || quantity->value.GetInt() <= 0) {
+            order.error = "item needs a category, an id and a positive quantity";
+            return;
+        }
+
+        string name = category->value.GetString();
+
+        if (!validCategoryName(name)) {
+            order.error = "invalid category " + name;
+            return;
+        }
+
+        order.items.push_back({name, id->value.GetInt(), quantity->value.GetInt()});
+    }
 }
 
 /**
- * @brief  Write and save a json file
- * @param  doc  The DOM of a json object
- * @param  savePath  The save location of a json file
+ * @brief  Take the products of an order out of stock and write its receipt with
+ *         the lines of a cart, like the receipt page does. The order is billed
+ *         on its own, the cart the user is filling at a lane is not touched.
+ *         Nothing is changed if any product of the order can't be served
+ * @param  order     The parsed order, its error is set if it is rejected
+ * @param  catalogs  The catalogs used so far, keyed by file path
+ * @param  receipts  The stream to append the receipt to
+ * @return  True if the order is checked out
  */
-void writeJsonFile(Document& doc, string savePath) {
-    fstream file(savePath, ios::out);
-    OStreamWrapper osw(file);
+bool batchCommitOrder(BatchOrder & order, map<string, CatalogCacheEntry *> & catalogs, ostream & receipts) {
+    vector<CatalogCacheEntry *> reserved;
+    // the snapshots the products were checked against, their names and
+    // prices are put into the cart
+    list<CatalogReader> snapshots;
+
+    // reserve the whole order before anything is put into the cart
+    for (const BatchItem & item : order.items) {
+        string filepath = catalogPath(item.category);
+        auto it = catalogs.find(filepath);
+
+        if (it == catalogs.end()) {
+            error_code ec;
+
+            if (!filesystem::exists(filepath, ec))
+                order.error = "unknown category " + item.category;
+            else
+                it = catalogs.emplace(filepath, &loadCatalog(filepath)).first;
+        }
+
+        while (order.error.empty()) {
+            const CatalogReader & snapshot = snapshots.emplace_back(*it->second);
+            ReserveResult result = NOT_ENOUGH_STOCK;
+
+            SizeType index = snapshot->find(item.productId);
+
+            if (index >= snapshot->size)
+                order.error = "unknown product " + to_string(item.productId) + " in " + item.category;
+            else if ((result = inventoryReserve(*it->second, *snapshot, index, item.quantity)) == RESERVED)
+                break;
+            else if (result == NOT_ENOUGH_STOCK)
+                order.error = "not enough stock of " + string(snapshot->name(index));
+            else {
+                // a restock replaced the snapshot, check the product against the next one
+                snapshots.pop_back();
+                this_thread::yield();
+            }
+        }
+
+        // give back what has been reserved for the order
+        if (!order.error.empty()) {
+            for (size_t i = 0; i < reserved.size(); i++)
+                inventoryRelease(*reserved[i], order.items[i].productId, order.items[i].quantity);
+
+            return false;
+        }
+
+        reserved.push_back(it->second);
+    }
+
+    // the receipt of the order, its items are the cart lines of the order
+    auto snapshot = snapshots.begin();
+    CartColumns lines;
+    StringBuffer buffer;
+    Writer<StringBuffer> writer(buffer);
+
+    writer.StartObject();
+    writer.Key("line");
+    writer.Int64(order.line);
+    writer.Key("userid");
+    writer.String(order.userid.c_str());
+    writer.Key("time");
+    writer.Int64(time(0));
+    writer.Key("items");
+    writer.StartArray();
+
+    for (size_t i = 0; i < reserved.size(); i++, snapshot++) {
+        SizeType index = (*snapshot)->find(order.items[i].productId);
+        int qty = order.items[i].quantity;
+        double price = (*snapshot)->price[index];
+
+        writer.StartObject();
+        writer.Key("id");
+        writer.Int((int) i + 1);
+        writer.Key("name");
+        writer.String((*snapshot)->name(index));
+        writer.Key("quantity");
+        writer.Int(qty);
+        writer.Key("price");
+        writer.Double(price);
+        writer.Key("amount");
+        writer.Double(price * qty);
+        writer.EndObject();
+
+        lines.quantity.push_back(qty);
+        lines.price.push_back(price);
+    }
+
+    writer.EndArray();
+    writer.Key("total");
+    writer.Double(cartTotal(lines));
+    writer.EndObject();
 
-    PrettyWriter<OStreamWrapper> writer(osw);
-    doc.Accept(writer);
+    receipts << buffer.GetString() << '\n';
+
+    return true;
 }
 
-/** 
- * @brief  Find and return the position of logged user in json file
- * @param  users  The "users" array in json file
- * @param  allocator  The allocator of DOM
+#ifdef SUPERMARKET_BENCH
+/**
+ * @brief  Time an operation and print its cost. The operation is run in batches
+ *         of doubling size until a batch takes long enough to be measured
+ * @param  name       The name of the operation
+ * @param  operation  Run the operation once and return the bytes it has written
  */
-int jsonFindUserPosition(Value & users) {
-    int position = -1;
-    
-    // loop and check if the value of "userid" key match with the value of userid in
-    // loginInfo structure
-    for (SizeType i = 0; i < users.Size(); i++) {
-        if (users[i]["userid"].GetString() == loginInfo.userid) {
-            position = i;
-        } 
+template <typename F>
+void benchCase(const char * name, F operation) {
+    size_t bytes = operation();
+
+    for (long batch = 1; ; batch *= 2) {
+        size_t allocations = benchAllocations.load();
+        auto start = chrono::steady_clock::now();
+
+        bytes = 0;
+        for (long i = 0; i < batch; i++)
+            bytes += operation();
+
+        double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+
+        if (elapsed < 2e8 && batch < (1L << 30))
+            continue;
+
+        cout << left << setw(26) << name << right << fixed
+             << setw(10) << batch
+             << setw(16) << setprecision(1) << elapsed / batch
+             << setw(14) << setprecision(2) << double(benchAllocations.load() - allocations) / batch
+             << setw(14) << setprecision(0) << double(bytes) / batch << '\n';
+        return;
     }
+}
 
-    // return -1 if user not found
-    return (position != -1) ? position : -1;
+/**
+ * @brief  Get the memory used by this process
+ * @return  The resident set size in kB, 0 if it can't be read
+ */
+long benchResidentKb() {
+    ifstream status("/proc/self/status");
+    string line;
+
+    while (getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            return atol(line.c_str() + 6);
+    }
+
+    return 0;
 }
 
 /**
- * @brief  Create and append the info of new user into the json file
- * @param  users  The "users" array in json file
- * @param  allocator  The allocator of DOM
- * @return  The position of the new user in json file
+ * @brief  Run the microbenchmarks of the I/O and rendering helpers on synthetic
+ *         data in a temporary folder. Only built with SUPERMARKET_BENCH defined:
+ *           g++ -std=c++17 -O2 -DSUPERMARKET_BENCH supermarket.cpp -o bench
+ *           ./bench --bench [size]
+ * @param  size  The number of products, users and credentials of the data
+ * @return  The exit status of the program
  */
-int jsonCreateNewUser(Value & users, Document::AllocatorType & allocator) {
-    int position = 0;
+int runBench(int size) {
+    filesystem::path benchDir = filesystem::temp_directory_path() / "supermarket-bench";
+    filesystem::path workDir = filesystem::current_path();
+    error_code ec;
+
+    if (size <= 0) {
+        cerr << "size of bench data must be positive\n";
+        return 1;
+    }
 
-    // initialize a empty value of json object
-    Value newCart(kArrayType);
-    Value newUsersObject(kObjectType);
-    Value userid(loginInfo.userid.c_str(), allocator) ;
+    filesystem::remove_all(benchDir, ec);
+    filesystem::create_directories(benchDir / "data");
+    filesystem::current_path(benchDir);
 
-    // exp: 
-    // {
-    //    "useid": 1,
-    //    "cart": []
-    // }
-    newUsersObject.AddMember("userid", userid, allocator);
-    newUsersObject.AddMember("cart", newCart, allocator);
+    // catalog of products
+    Document catalog(kObjectType);
+    Document::AllocatorType & allocator = catalog.GetAllocator();
+    Value products(kArrayType);
 
-    position = users.Size();
-    users.PushBack(newUsersObject, allocator);
+    for (int i = 1; i <= size; i++) {
+        Value product(kObjectType);
+        Value name(("Product " + to_string(i)).c_str(), allocator);
 
-    return position;
+        product.AddMember("id", i, allocator);
+        product.AddMember("name", name, allocator);
+        product.AddMember("quantity", 100, allocator);
+        product.AddMember("price", 9.99, allocator);
+        products.PushBack(product, allocator);
+    }
+    catalog.AddMember("category", "Bench", allocator);
+    catalog.AddMember("products", products, allocator);
+    writeJsonFile(catalog, "data/bench.json");
+
+    // carts of users, the layout used by the cart file
+    Document carts(kArrayType);
+    string lastUserid = to_string(size);
+
+    for (int i = 1; i <= size; i++)
+        jsonCreateNewUser(carts, to_string(i), carts.GetAllocator());
+
+    // credentials file
+    {
+        fstream file(CREDENTIALS_FILE_PATH, ios::out | ios::binary);
+
+        file << formatCredential({"userid", "username", "password"});
+        for (int i = 1; i <= size; i++)
+            file << formatCredential({to_string(i), "user" + to_string(i), "pass"});
+    }
+
+    static constexpr Column columns[] = {NO_COLUMN, ITEM_COLUMN, QTY_COLUMN, PRICE_COLUMN};
+    Value & catalogProducts = catalog["products"];
+    vector<string> usernames;
+    size_t nextUsername = 0;
+
+    for (int i = 1; i <= size; i++)
+        usernames.push_back("user" + to_string(i));
+
+    cout << "bench size " << size << "\n\n"
+         << left << setw(26) << "operation" << right << setw(10) << "ops"
+         << setw(16) << "ns/op" << setw(14) << "allocs/op" << setw(14) << "bytes/op" << '\n';
+
+    benchCase("readJsonFile", [] {
+        Document doc = readJsonFile("data/bench.json");
+        return (size_t) 0;
+    });
+    benchCase("writeJsonFile", [&] {
+        writeJsonFile(catalog, "data/bench.json");
+        return (size_t) filesystem::file_size("data/bench.json");
+    });
+    benchCase("jsonFindUserPosition", [&] {
+        // the last user is the worst case of the scan
+        return (size_t) (jsonFindUserPosition(carts, lastUserid) < 0);
+    });
+    benchCase("jsonCreateNewUser", [] {
+        Document users(kArrayType);
+        jsonCreateNewUser(users, "1", users.GetAllocator());
+        return (size_t) 0;
+    });
+    benchCase("displayTable", [&] {
+        displayTable(columns, catalogProducts);
+
+        size_t bytes = frameBuffer.text.size();
+        frameBuffer.text.clear();
+        return bytes;
+    });
+    benchCase("displayTable (one page)", [&] {
+        displayTable(columns, catalogProducts, 0, PRODUCT_PAGE_ROWS);
+
+        size_t bytes = frameBuffer.text.size();
+        frameBuffer.text.clear();
+        return bytes;
+    });
+    benchCase("printCenter", [] {
+        printCenter("Welcome to Tesco Supermarket", bg_blue);
+
+        size_t bytes = frameBuffer.text.size();
+        frameBuffer.text.clear();
+        return bytes;
+    });
+    benchCase("credentialsLoad (scan)", [] {
+        // force the whole file to be read again
+        credentialStore.loaded = false;
+        credentialsLoad();
+        return (size_t) 0;
+    });
+    benchCase("credentialsFind", [&] {
+        // look up every user in turn, so the lookup can't be hoisted out of the loop
+        const string & username = usernames[nextUsername++ % usernames.size()];
+        return (size_t) (credentialsFind(username) == nullptr);
+    });
+
+    CatalogCacheEntry & hotCatalog = loadCatalog("data/bench.json");
+    CatalogReader hotSnapshot(hotCatalog);
+
+    hotSnapshot->stock[0] = numeric_limits<int>::max();
+    benchCase("inventoryReserve", [&] {
+        return (size_t) (inventoryReserve(hotCatalog, *hotSnapshot, 0, 1) != RESERVED);
+    });
+
+    Document window;
+
+    benchCase("catalogWindow (one page)", [&] {
+        catalogWindow(loadCatalog("data/bench.json"), 0, PRODUCT_PAGE_ROWS, window);
+        return (size_t) 0;
+    });
+
+    // the value of the stock of the whole catalog, read through the members
+    // of the DOM objects and streamed from the columns
+    Document hotDoc = readJsonFile("data/bench.json");
+    const Value & hotProducts = hotDoc["products"];
+    double stockValue = 0.0;
+
+    benchCase("catalog scan (DOM)", [&] {
+        for (const auto & product : hotProducts.GetArray())
+            stockValue += product["price"].GetDouble() * product["quantity"].GetInt();
+        return (size_t) 0;
+    });
+    benchCase("catalog scan (columns)", [&] {
+        for (SizeType i = 0; i < hotSnapshot->size; i++)
+            stockValue += hotSnapshot->price[i] * hotSnapshot->quantity(i);
+        return (size_t) 0;
+    });
+
+    // the total of a bulk order cart, summed over the amount of each DOM
+    // object and by each kernel of cartTotal over the columns
+    Document bulkDoc(kArrayType);
+    CartColumns bulkCart;
+
+    for (int i = 0; i < size; i++) {
+        Value line(kObjectType);
+        int qty = 1 + i % 12;
+        double price = 0.5 + (i % 997) * 0.25;
+
+        line.AddMember("quantity", qty, bulkDoc.GetAllocator());
+        line.AddMember("price", price, bulkDoc.GetAllocator());
+        line.AddMember("amount", price * qty, bulkDoc.GetAllocator());
+        bulkDoc.PushBack(line, bulkDoc.GetAllocator());
+        bulkCart.quantity.push_back(qty);
+        bulkCart.price.push_back(price);
+    }
+
+    double cartSum = 0.0;
+    double scalarTotal = cartTotalScalar(bulkCart.quantity.data(), bulkCart.price.data(), size);
+
+    benchCase("cart total (DOM)", [&] {
+        SizeType hint = 0;
+
+        for (const auto & line : bulkDoc.GetArray())
+            cartSum += columnValue(line, AMOUNT_COLUMN, hint).GetDouble();
+        return (size_t) 0;
+    });
+    benchCase("cart total (scalar)", [&] {
+        cartSum += cartTotalScalar(bulkCart.quantity.data(), bulkCart.price.data(), size);
+        return (size_t) 0;
+    });
+#ifdef CART_TOTAL_SIMD
+    benchCase("cart total (sse2)", [&] {
+        cartSum += cartTotalSse2(bulkCart.quantity.data(), bulkCart.price.data(), size);
+        return (size_t) 0;
+    });
+    if (__builtin_cpu_supports("avx")) {
+        benchCase("cart total (avx)", [&] {
+            cartSum += cartTotalAvx(bulkCart.quantity.data(), bulkCart.price.data(), size);
+            return (size_t) 0;
+        });
+    }
+#endif
+#ifdef CART_TOTAL_SIMD
+    bool totalsMatch = cartTotalSse2(bulkCart.quantity.data(), bulkCart.price.data(), size) == scalarTotal &&
+                       (!__builtin_cpu_supports("avx") ||
+                        cartTotalAvx(bulkCart.quantity.data(), bulkCart.price.data(), size) == scalarTotal);
+#else
+    bool totalsMatch = cartTotal(bulkCart) == scalarTotal;
+#endif
+
+    // many threads take one hot product until it is sold out, every
+    // unit must be sold exactly once
+    const int hotStock = 1000000;
+    unsigned hotThreads = max(8u, thread::hardware_concurrency());
+    atomic<long> sold{0};
+    vector<thread> buyers;
+
+    hotSnapshot->stock[0] = hotStock;
+
+    auto start = chrono::steady_clock::now();
+
+    for (unsigned t = 0; t < hotThreads; t++) {
+        buyers.emplace_back([&] {
+            long taken = 0;
+
+            while (inventoryReserve(hotCatalog, *hotSnapshot, 0, 1) == RESERVED)
+                taken++;
+
+            sold += taken;
+        });
+    }
+    for (thread & buyer : buyers)
+        buyer.join();
+
+    double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    bool conserved = sold == hotStock && hotSnapshot->stock[0] == 0;
+
+    cout << "\nhot product: " << hotThreads << " threads sold " << sold << " of " << hotStock
+         << setprecision(1) << ", " << elapsed / hotStock << " ns/unit, stock left "
+         << hotSnapshot->stock[0] << (conserved ? ", no unit lost or oversold\n" : ", STOCK NOT CONSERVED\n");
+
+    persistFlush();
+
+    // threads render pages of a catalog while restocks replace its file, every
+    // product of a restock has the same price and a quantity of 1000 times it,
+    // so a page mixing two restocks or a half-applied one is seen
+    const int restocks = 100;
+    atomic<bool> restocking{true};
+    atomic<long> pages{0};
+    atomic<long> mixed{0};
+    vector<thread> browsers;
+
+    auto restockCatalog = [&](int restock) {
+        for (auto & product : catalogProducts.GetArray()) {
+            product["price"].SetDouble(restock);
+            product["quantity"].SetInt(restock * 1000);
+        }
+
+        writeJsonFile(catalog, "data/bench.json");
+    };
+
+    // the browsers start from a restocked catalog
+    restockCatalog(1);
+    loadCatalog("data/bench.json");
+
+    for (unsigned t = 0; t < hotThreads; t++) {
+        browsers.emplace_back([&] {
+            Document page;
+
+            while (restocking) {
+                // the whole catalog as one page, its copy spans a restock
+                // even when the threads share one processor
+                catalogWindow(loadCatalog("data/bench.json"), 0, size, page);
+
+                const Value & products = page["products"];
+
+                for (SizeType i = 0; i < products.Size(); i++) {
+                    if (products[i]["price"] != products[0]["price"] ||
+                        products[i]["quantity"].GetInt() != products[0]["quantity"].GetInt() ||
+                        products[i]["quantity"].GetInt() != (int) (products[i]["price"].GetDouble() * 1000)) {
+                        mixed++;
+                        break;
+                    }
+                }
+                pages++;
+            }
+        });
+    }
+
+    for (int restock = 2; restock <= restocks; restock++) {
+        restockCatalog(restock);
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+
+    restocking = false;
+    for (thread & browser : browsers)
+        browser.join();
+
+    // a page is copied while a restock holds the catalog, readers never
+    // wait for the writers
+    CatalogCacheEntry & restocked = loadCatalog("data/bench.json");
+    atomic<bool> copied{false};
+    bool waited;
+
+    catalogLock.lock();
+
+    thread browser([&] {
+        Document page;
+
+        catalogWindow(restocked, 0, PRODUCT_PAGE_ROWS, page);
+        copied = true;
+    });
+
+    for (int waits = 0; waits < 1000 && !copied; waits++)
+        this_thread::sleep_for(chrono::milliseconds(1));
+    waited = !copied;
+    catalogLock.unlock();
+    browser.join();
+
+    // a shopper logs in, pages through the catalog, looks at the cart and
+    // logs out again and again. The pages are displayed by the dispatcher of
+    // main, so the memory must stay the same whatever the number of screens
+    struct ScriptedInput : streambuf {
+        string script;
+
+        // start the script again when it has been read
+        int underflow() override {
+            setg(&script[0], &script[0], &script[0] + script.size());
+            return traits_type::to_int_type(script[0]);
+        }
+    };
+
+    const long soakTransitions = 10000000;
+    const long soakWarmup = 100000;
+    ScriptedInput shopper;
+    streambuf * keyboard = cin.rdbuf(&shopper);
+    Page page = WELCOME_PAGE;
+    long shown[EXIT_PAGE + 1] = {};
+    long transitions = 0;
+    long warmResident = 0;
+
+    shopper.script = "1 user1 pass 1 1 n p b b 3 b 4\n";
+    catalogPreload();
+
+    // the shopper's pages are first presented like main does, with the frame
+    // flushed when a page reads its input, and the output thrown away. Each
+    // frame must reach the terminal in one write
+    const long framedTransitions = 10000;
+    ostream * tied = cin.tie(&frame);
+#ifndef _WIN32
+    int terminal = dup(STDOUT_FILENO);
+    int discard = open("/dev/null", O_WRONLY);
+
+    dup2(discard, STDOUT_FILENO);
+    close(discard);
+#endif
+
+    for (long i = 0; i < framedTransitions && page != EXIT_PAGE && cin; i++) {
+        page = ::pages[page]();
+        shown[page]++;
+    }
+    presentFrame();
+
+#ifndef _WIN32
+    dup2(terminal, STDOUT_FILENO);
+    close(terminal);
+#endif
+    cin.tie(tied);
+
+    bool oneWrite = benchFrames > 0 && benchFrameWrites == benchFrames;
+
+    start = chrono::steady_clock::now();
+
+    while (transitions < soakTransitions && page != EXIT_PAGE && cin) {
+        page = ::pages[page]();
+        frameBuffer.text.clear();
+        shown[page]++;
+
+        if (++transitions == soakWarmup)
+            warmResident = benchResidentKb();
+    }
+
+    elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    cin.rdbuf(keyboard);
+
+    long soakResident = benchResidentKb();
+    // the shopper must have logged in and seen the products and the cart
+    bool flat = transitions == soakTransitions && shown[PRODUCT_PAGE] > 0 && shown[CART_PAGE] > 0 &&
+                soakResident - warmResident <= 1024;
+
+    // keeps the scans and totals from being optimized away
+    if (stockValue < 0 || cartSum < 0)
+        cout << stockValue << cartSum;
+
+    cout << "cart total: " << size << " lines, "
+         << (totalsMatch ? "every kernel gives the scalar total\n" : "KERNELS DISAGREE WITH THE SCALAR TOTAL\n");
+
+    cout << "restock: " << restocks << " restocks while " << hotThreads << " threads rendered " << pages
+         << " pages, " << (mixed == 0 ? "no page mixed two restocks" : "PAGES MIXED TWO RESTOCKS")
+         << (waited ? ", A PAGE WAITED FOR A RESTOCK\n" : ", no page waits for a restock\n");
+
+    cout << "frames: " << benchFrames << " frames over " << framedTransitions << " page transitions"
+         << setprecision(1) << ", " << (double) benchFrameBytes / max<size_t>(benchFrames, 1) << " bytes and "
+         << setprecision(2) << (double) benchFrameWrites / max<size_t>(benchFrames, 1) << " writes per frame"
+         << (oneWrite ? ", every frame written at once\n" : ", A FRAME TOOK MORE THAN ONE WRITE\n");
+
+    cout << "soak: " << transitions << " page transitions" << setprecision(1) << ", "
+         << elapsed / transitions << " ns/transition, resident " << warmResident << " kB after "
+         << soakWarmup << " and " << soakResident << " kB after all"
+         << (flat ? ", memory stays flat\n" : ", MEMORY GROWS WITH THE TRANSITIONS\n");
+
+    filesystem::current_path(workDir);
+    filesystem::remove_all(benchDir, ec);
+
+    return conserved && mixed == 0 && !waited && totalsMatch && oneWrite && flat ? 0 : 1;
+}
+#endif
+
+/**
+ * @brief  Log in a user, remember the user as logged user if succeeded
+ * @param  username  The username entered
+ * @param  password  The password entered
+ * @return  True if the username and password are match
+ */
+bool storeLogin(const string & username, const string & password) {
+    if (laneSocket < 0)
+        return loginUser(username, password);
+
+    string reply = laneCall({"LOGIN", username, password});
+
+    if (reply.compare(0, 3, "OK\t") != 0)
+        return false;
+
+    loginInfo = {reply.substr(3), username, password};
+    return true;
+}
+
+/**
+ * @brief  Set up the account of a new user
+ * @param  username  The username of new user
+ * @param  password  The password of new user
+ * @return  The userid of new user, empty if the username already exist
+ */
+string storeSignup(const string & username, const string & password) {
+    if (laneSocket < 0)
+        return credentialsSignup(username, password);
+
+    string reply = laneCall({"SIGNUP", username, password});
+
+    return reply.compare(0, 3, "OK\t") == 0 ? reply.substr(3) : "";
+}
+
+/**
+ * @brief  Change the username and password of a user
+ * @param  username     The current username of the user
+ * @param  password     The current password of the user
+ * @param  newUsername  The new username
+ * @param  newPassword  The new password
+ * @return  False if the new username belongs to another user
+ */
+bool storeUpdateAccount(const string & username, const string & password,
+                        const string & newUsername, const string & newPassword) {
+    if (laneSocket < 0)
+        return credentialsUpdate(username, password, newUsername, newPassword);
+
+    return laneCall({"ACCOUNT", username, password, newUsername, newPassword}) == "OK";
+}
+
+/**
+ * @brief  Get the categories that can be browsed
+ * @return  The categories of the valid catalogs, sorted by name
+ */
+vector<CatalogCategory> storeCategories() {
+    if (laneSocket < 0)
+        return catalogCategories;
+
+    vector<CatalogCategory> categories;
+    stringstream reply(laneCall({"CATEGORIES"}));
+    string name;
+    string title;
+
+    // the reply is OK followed by the name and the title of every category
+    if (getline(reply, name, '\t') && name == "OK") {
+        while (getline(reply, name, '\t') && getline(reply, title, '\t'))
+            categories.push_back({name, title});
+    }
+
+    return categories;
+}
+
+/**
+ * @brief  Get a page of the products of a category
+ * @param  category  The name of the category
+ * @param  offset    Index of the first product of the page
+ * @param  count     Maximum number of products of the page
+ * @return  The page, an object with the "category" name, the "size" of the
+ *          category and the "products" of the page. Valid until next call
+ */
+Document & storeCatalogPage(const string & category, SizeType offset, SizeType count) {
+    static Document page;
+
+    if (laneSocket < 0) {
+        catalogWindow(loadCatalog(catalogPath(category)), offset, count, page);
+        return page;
+    }
+
+    string reply = laneCall({"CATALOG", category, to_string(offset), to_string(count)});
+
+    page.SetObject();
+    page.GetAllocator().Clear();
+
+    if (reply.compare(0, 3, "OK\t") != 0 || page.Parse(reply.c_str() + 3).HasParseError()) {
+        page.SetObject();
+        page.AddMember("category", Value(category.c_str(), page.GetAllocator()), page.GetAllocator());
+        page.AddMember("size", 0, page.GetAllocator());
+        page.AddMember("products", Value(kArrayType), page.GetAllocator());
+    }
+
+    return page;
+}
+
+/**
+ * @brief  Find where a product is in its category
+ * @param  category   The name of the category
+ * @param  productId  The id of the product
+ * @return  The index of the product in the category, -1 if there is none
+ */
+long storeFindProduct(const string & category, int productId) {
+    if (laneSocket >= 0) {
+        string reply = laneCall({"FIND", category, to_string(productId)});
+
+        return reply.compare(0, 3, "OK\t") == 0 ? strtol(reply.c_str() + 3, nullptr, 10) : -1;
+    }
+
+    CatalogReader snapshot(loadCatalog(catalogPath(category)));
+    SizeType index = snapshot->find(productId);
+
+    return index < snapshot->size ? (long) index : -1;
+}
+
+/**
+ * @brief  Put a product into the cart of a user and take it out of stock
+ * @param  userid     The userid of the user
+ * @param  category   The name of the category
+ * @param  productId  The id of the product in the category
+ * @param  quantity   The quantity bought
+ * @return  False if the product doesn't exist or there is not enough stock
+ */
+bool storeAddToCart(const string & userid, const string & category, int productId, int quantity) {
+    if (laneSocket >= 0)
+        return laneCall({"ADD", userid, category, to_string(productId), to_string(quantity)}) == "OK";
+
+    return addProductToCart(userid, loadCatalog(catalogPath(category)), productId, quantity);
+}
+
+/**
+ * @brief  Get a copy of the items in the cart of a user
+ * @param  userid  The userid of the user
+ * @return  The items of the cart, valid until the next call
+ */
+Value & storeCart(const string & userid) {
+    static Document cart;
+
+    cart.SetArray();
+    cart.GetAllocator().Clear();
+
+    if (laneSocket < 0) {
+        cartFind(userid, cart);
+        return cart;
+    }
+
+    string reply = laneCall({"CART", userid});
+
+    if (reply.compare(0, 3, "OK\t") != 0 || cart.Parse(reply.c_str() + 3).HasParseError())
+        cart.SetArray();
+
+    return cart;
+}
+
+/**
+ * @brief  Get the total amount of the cart of a user
+ * @param  userid  The userid of the user
+ * @return  The total amount to pay
+ */
+double storeCartTotal(const string & userid) {
+    if (laneSocket < 0)
+        return cartFindTotal(userid);
+
+    string reply = laneCall({"TOTAL", userid});
+
+    if (reply.compare(0, 3, "OK\t") != 0)
+        return 0.0;
+
+    return strtod(reply.c_str() + 3, nullptr);
+}
+
+/**
+ * @brief  Remove an item from the cart of a user
+ * @param  userid  The userid of the user
+ * @param  id      The number of the item in the cart, start from 1
+ */
+void storeRemoveCartLine(const string & userid, int id) {
+    if (laneSocket < 0)
+        cartRemoveLine(userid, id);
+    else
+        laneCall({"REMOVE", userid, to_string(id)});
+}
+
+/**
+ * @brief  Accept the payment of the cart of a user, the barrier of a payment:
+ *         wait until the stock the cart took is written before the receipt
+ * @param  userid  The userid of the user
+ * @return  False if the stock couldn't be written, the payment is not accepted
+ */
+bool storePay(const string & userid) {
+    if (laneSocket >= 0)
+        return laneCall({"PAY", userid}) == "OK";
+
+    return persistFlush(cartCatalogs(userid));
+}
+
+/**
+ * @brief  Remove all items from the cart of a user once it's paid
+ * @param  userid  The userid of the user
+ */
+void storeClearCart(const string & userid) {
+    if (laneSocket >= 0)
+        laneCall({"CLEAR", userid});
+    else
+        cartClear(userid);
+}
+
+/**
+ * @brief  Keep the catalogs, carts and credentials in memory and serve the
+ *         lanes connected to a unix domain socket, one thread per lane.
+ *         A request is a line of tab separated fields, the first one is the verb:
+ *           LOGIN username password                   -> OK userid
+ *           SIGNUP username password                  -> OK userid
+ *           ACCOUNT username password newname newpass -> OK
+ *           CATEGORIES                                -> OK name title ...
+ *           CATALOG category offset count             -> OK {"category","size","products"}
+ *           FIND category id                          -> OK index
+ *           ADD userid category id quantity           -> OK
+ *           CART userid                               -> OK [items]
+ *           TOTAL userid                              -> OK amount
+ *           REMOVE userid id                          -> OK
+ *           PAY userid                                -> OK, once the stock is written
+ *           CLEAR userid                              -> OK
+ *         A lane is bound to the user it has logged in or signed up as, the
+ *         requests on an account or a cart are only accepted for that user.
+ *         A request that fails is answered with ERR and the reason.
+ *         The server is stopped with SIGINT or SIGTERM, the files waiting
+ *         for the persister are written before it exits
+ * @param  socketPath  The location of the socket
+ * @return  The exit status of the program
+ */
+int runServer(const char * socketPath) {
+#ifndef _WIN32
+    sockaddr_un address = {};
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        cerr << "socket path too long: " << socketPath << '\n';
+        return 1;
+    }
+
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+
+    // the socket left by a server that has stopped
+    unlink(socketPath);
+
+    if (listener < 0 || bind(listener, (sockaddr *) &address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        cerr << "cannot listen on " << socketPath << ": " << strerror(errno) << '\n';
+        return 1;
+    }
+
+    // the stop signals are taken by one thread, every thread started from
+    // here blocks them
+    sigset_t stopSignals;
+
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+
+    thread([stopSignals, socketPath] {
+        int signal;
+
+        sigwait(&stopSignals, &signal);
+        cout << "stopping, writing the pending files" << endl;
+
+        // the lanes still connected write their files themselves from now on
+        persistStop();
+        unlink(socketPath);
+        _exit(0);
+    }).detach();
+
+    catalogPreload();
+    cout << "serving " << catalogCategories.size() << " catalogs to lanes on " << socketPath << endl;
+
+    while (true) {
+        int lane = accept(listener, nullptr, nullptr);
+
+        if (lane < 0) {
+            if (errno == EINTR)
+                continue;
+
+            cerr << "accept failed: " << strerror(errno) << '\n';
+            return 1;
+        }
+
+        thread(serveLane, lane).detach();
+    }
+#else
+    cerr << "lanes need unix domain sockets, which are not supported on this platform\n";
+    return 1;
+#endif
+}
+
+/**
+ * @brief  Answer the requests of a lane until it disconnects
+ * @param  lane  The socket connected to the lane
+ */
+void serveLane(int lane) {
+#ifndef _WIN32
+    char buffer[4096];
+    string received;
+    string userid;
+    ssize_t length;
+
+    while ((length = read(lane, buffer, sizeof(buffer))) > 0) {
+        received.append(buffer, length);
+
+        size_t start = 0;
+        size_t end;
+        string replies;
+
+        // a lane may send more than one request at once
+        while ((end = received.find('\n', start)) != string::npos) {
+            replies += serverHandle(received.substr(start, end - start), userid);
+            replies += '\n';
+            start = end + 1;
+        }
+        received.erase(0, start);
+
+        for (size_t sent = 0; sent < replies.size(); ) {
+            ssize_t written = send(lane, replies.data() + sent, replies.size() - sent, MSG_NOSIGNAL);
+
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0) {
+                close(lane);
+                return;
+            }
+            sent += written;
+        }
+    }
+
+    close(lane);
+#endif
+}
+
+/**
+ * @brief  Carry out a request of a lane
+ * @param  request  The request without the newline
+ * @param  userid   The userid the lane is logged in as, empty before login.
+ *                  Set by a login or signup
+ * @return  The reply without the newline
+ */
+string serverHandle(const string & request, string & userid) {
+    vector<string> fields;
+    stringstream str(request);
+    string field;
+
+    while (getline(str, field, '\t'))
+        fields.push_back(field);
+
+    if (fields.empty())
+        return "ERR\tempty request";
+
+    const string & verb = fields[0];
+
+    try {
+        if (verb == "LOGIN" && fields.size() == 3) {
+            lock_guard<mutex> guard(serverLocks.credentials);
+
+            credentialsLoad();
+            Credential * credential = credentialsFind(fields[1]);
+
+            userid.clear();
+
+            if (credential == nullptr || credential->password != fields[2])
+                return "ERR\tinvalid username or password";
+
+            userid = credential->userid;
+            return "OK\t" + userid;
+        }
+        else if (verb == "SIGNUP" && fields.size() == 3) {
+            lock_guard<mutex> guard(serverLocks.credentials);
+
+            if (!validCredential(fields[1], fields[2]))
+                return "ERR\tinvalid username or password";
+
+            string newUserid = credentialsSignup(fields[1], fields[2]);
+
+            if (newUserid.empty())
+                return "ERR\tusername already exist";
+
+            userid = newUserid;
+            return "OK\t" + userid;
+        }
+        else if (verb == "ACCOUNT" && fields.size() == 5) {
+            lock_guard<mutex> guard(serverLocks.credentials);
+
+            credentialsLoad();
+            Credential * credential = credentialsFind(fields[1]);
+
+            if (credential == nullptr || credential->userid != userid)
+                return "ERR\tnot logged in";
+
+            return credentialsUpdate(fields[1], fields[2], fields[3], fields[4]) ? "OK" : "ERR\tcannot change account";
+        }
+        else if (verb == "CATEGORIES" && fields.size() == 1) {
+            string reply = "OK";
+
+            for (const CatalogCategory & category : catalogCategories) {
+                reply += '\t' + category.name + '\t';
+
+                for (char c : category.title)
+                    reply += (c == '\t' || c == '\n') ? ' ' : c;
+            }
+
+            return reply;
+        }
+        else if ((verb == "ADD" || verb == "CART" || verb == "TOTAL" || verb == "REMOVE" ||
+                  verb == "PAY" || verb == "CLEAR") &&
+                 (fields.size() < 2 || userid.empty() || fields[1] != userid)) {
+            // the userid names the files of the cart, so only the userid
+            // given by the credentials of this lane is trusted
+            return "ERR\tnot logged in";
+        }
+        else if (verb == "CATALOG" && fields.size() == 4) {
+            CatalogCacheEntry * catalog = serverLoadCatalog(fields[1]);
+
+            if (catalog == nullptr)
+                return "ERR\tunknown category";
+
+            Document page;
+            StringBuffer buffer;
+            Writer<StringBuffer> writer(buffer);
+
+            // copied from a snapshot, a restock meanwhile is not seen half done
+            catalogWindow(*catalog, stoul(fields[2]), stoul(fields[3]), page);
+
+            page.Accept(writer);
+            return "OK\t" + string(buffer.GetString(), buffer.GetSize());
+        }
+        else if (verb == "FIND" && fields.size() == 3) {
+            CatalogCacheEntry * catalog = serverLoadCatalog(fields[1]);
+
+            if (catalog == nullptr)
+                return "ERR\tunknown category";
+
+            CatalogReader snapshot(*catalog);
+            SizeType index = snapshot->find(stoi(fields[2]));
+
+            if (index == snapshot->size)
+                return "ERR\tunknown product";
+
+            return "OK\t" + to_string(index);
+        }
+        else if (verb == "ADD" && fields.size() == 5) {
+            CatalogCacheEntry * catalog = serverLoadCatalog(fields[2]);
+
+            if (catalog == nullptr)
+                return "ERR\tunknown category";
+
+            // the stock is taken with atomic operations, lanes selling
+            // the same product don't wait for each other
+            int productId = stoi(fields[3]);
+            CatalogReader snapshot(*catalog);
+
+            if (snapshot->find(productId) == snapshot->size)
+                return "ERR\tunknown product";
+
+            if (!addProductToCart(fields[1], *catalog, productId, stoi(fields[4])))
+                return "ERR\tnot enough stock";
+
+            return "OK";
+        }
+        else if (verb == "CART" && fields.size() == 2) {
+            CartShard & shard = cartShard(fields[1]);
+            StringBuffer buffer;
+            Writer<StringBuffer> writer(buffer);
+
+            {
+                lock_guard<mutex> guard(shard.lock);
+
+                cartReplayLog(shard);
+                shard.doc["cart"].Accept(writer);
+            }
+
+            return "OK\t" + string(buffer.GetString(), buffer.GetSize());
+        }
+        else if (verb == "TOTAL" && fields.size() == 2) {
+            char total[32];
+
+            // enough digits to read back the same double
+            snprintf(total, sizeof(total), "%.17g", cartFindTotal(fields[1]));
+            return "OK\t" + string(total);
+        }
+        else if (verb == "REMOVE" && fields.size() == 3) {
+            cartRemoveLine(fields[1], stoi(fields[2]));
+            return "OK";
+        }
+        else if (verb == "PAY" && fields.size() == 2) {
+            return persistFlush(cartCatalogs(fields[1])) ? "OK" : "ERR\tstock not written";
+        }
+        else if (verb == "CLEAR" && fields.size() == 2) {
+            cartClear(fields[1]);
+            return "OK";
+        }
+    }
+    catch (...) {
+        return "ERR\tinvalid request";
+    }
+
+    return "ERR\tunknown request";
+}
+
+/**
+ * @brief  Get the catalog of a category from the cache of server, loaded again
+ *         if a restock has changed its file
+ * @param  category  The name of the category
+ * @return  The cached catalog, nullptr if the category doesn't exist
+ */
+CatalogCacheEntry * serverLoadCatalog(const string & category) {
+    if (!validCategoryName(category))
+        return nullptr;
+
+    string filepath = catalogPath(category);
+    error_code ec;
+
+    if (catalogFind(filepath) == nullptr && !filesystem::exists(filepath, ec))
+        return nullptr;
+
+    return &loadCatalog(filepath);
+}
+
+/**
+ * @brief  Connect to the server, so the interface runs as a lane of it
+ * @param  socketPath  The location of the socket of server
+ * @return  False if the server can't be reached
+ */
+bool laneConnect(const char * socketPath) {
+#ifndef _WIN32
+    sockaddr_un address = {};
+
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        cerr << "socket path too long: " << socketPath << '\n';
+        return false;
+    }
+
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+    laneSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (laneSocket < 0 || connect(laneSocket, (sockaddr *) &address, sizeof(address)) != 0) {
+        cerr << "cannot connect to server at " << socketPath << ": " << strerror(errno) << '\n';
+        laneSocket = -1;
+        return false;
+    }
+
+    return true;
+#else
+    cerr << "lanes need unix domain sockets, which are not supported on this platform\n";
+    return false;
+#endif
+}
+
+/**
+ * @brief  Send a request to the server and wait for the reply
+ * @param  fields  The fields of the request, tabs and newlines in them are replaced by blanks
+ * @return  The reply without the newline
+ */
+string laneCall(initializer_list<string> fields) {
+#ifndef _WIN32
+    static string received;
+    string request;
+
+    for (const string & field : fields) {
+        if (!request.empty())
+            request += '\t';
+
+        for (char c : field)
+            request += (c == '\t' || c == '\n') ? ' ' : c;
+    }
+    request += '\n';
+
+    for (size_t sent = 0; sent < request.size(); ) {
+        ssize_t written = send(laneSocket, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            break;
+        sent += written;
+    }
+
+    size_t end;
+    char buffer[4096];
+
+    while ((end = received.find('\n')) == string::npos) {
+        ssize_t length = read(laneSocket, buffer, sizeof(buffer));
+
+        if (length < 0 && errno == EINTR)
+            continue;
+
+        // nothing can be done without the server
+        if (length <= 0) {
+            presentFrame();
+            cerr << "\nlost connection to server\n";
+            exit(1);
+        }
+
+        received.append(buffer, length);
+    }
+
+    string reply = received.substr(0, end);
+
+    received.erase(0, end + 1);
+    return reply;
+#else
+    return "ERR";
+#endif
+}
+
+/**
+ * @brief  Find the catalog file of a category
+ * @param  category  The name of the category, e.g. biscuit
+ * @return  The location of the catalog file
+ */
+string catalogPath(const string & category) {
+    return CATALOG_DIR_PATH "/" + category + ".json";
+}
+
+/**
+ * @brief  Check a category name sent by a lane or a batch file, it must name a
+ *         catalog file in data folder and nothing else
+ * @param  category  The name of the category
+ * @return  True if the name is made of lowercase letters, digits, '_' and '-'
+ */
+bool validCategoryName(const string & category) {
+    return !category.empty() &&
+        category.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789_-") == string::npos;
+}
+
+/**
+ * @brief  Check the credentials of a new or changed account, they must fit the
+ *         fixed size records of credentials file and keep its fields apart
+ * @param  username  The username of the account
+ * @param  password  The password of the account
+ * @return  True if both are not empty, not longer than their limits and
+ *          contain neither blank nor comma
+ */
+bool validCredential(const string & username, const string & password) {
+    auto valid = [](const string & text, size_t width) {
+        if (text.empty() || text.size() > width)
+            return false;
+
+        for (char c : text) {
+            if (isspace((unsigned char) c) || c == ',')
+                return false;
+        }
+        return true;
+    };
+
+    return valid(username, USERNAME_WIDTH) && valid(password, PASSWORD_WIDTH);
+}
+
+/**
+ * @brief  Copy a page of the products of a catalog with their current stock
+ * @param  catalog  The cached catalog
+ * @param  offset   Index of the first product of the page
+ * @param  count    Maximum number of products of the page
+ * @param  page     Receive the "category" name, the "size" of the catalog and
+ *                  the "products" of the page, what it held before is freed
+ */
+void catalogWindow(const CatalogCacheEntry & catalog, SizeType offset, SizeType count, Document & page) {
+    Document::AllocatorType & allocator = page.GetAllocator();
+    // the prices and quantities of a page all come from one snapshot, a
+    // restock publishes the next one without changing this one
+    CatalogReader snapshot(catalog);
+    Value window(kArrayType);
+
+    // the page is rebuilt in place, its pool is reused instead of growing
+    page.SetObject();
+    allocator.Clear();
+
+    // read from the columns of the catalog, the names are copied. Sales
+    // go on meanwhile, each quantity is read atomically
+    for (SizeType i = offset; i < snapshot->size && i - offset < count; i++) {
+        Value product(kObjectType);
+
+        product.MemberReserve(4, allocator);
+        product.AddMember("id", snapshot->id[i], allocator);
+        product.AddMember("name", Value(snapshot->name(i), allocator), allocator);
+        product.AddMember("quantity", snapshot->quantity(i), allocator);
+        product.AddMember("price", snapshot->price[i], allocator);
+        window.PushBack(product, allocator);
+    }
+
+    page.AddMember("category", Value(snapshot->head["category"], allocator, true), allocator);
+    page.AddMember("size", snapshot->size, allocator);
+    page.AddMember("products", window, allocator);
+}
+
+/**
+ * @brief  Check the username and password, remember the user as logged user if match
+ * @param  username  The username entered
+ * @param  password  The password entered
+ * @return  True if the username and password are match
+ */
+bool loginUser(const string & username, const string & password) {
+    credentialsLoad();
+    Credential * credential = credentialsFind(username);
+
+    if (credential == nullptr || credential->password != password)
+        return false;
+
+    loginInfo = {credential->userid, credential->username, credential->password};
+    return true;
+}
+
+/**
+ * @brief  Take the quantity of a product out of the stock of the catalog
+ *         and put it into the cart of a user
+ * @param  userid    The userid of the user
+ * @param  catalog   The cached catalog the product belongs to
+ * @param  index     The index of the product in the catalog
+ * @param  quantity  The quantity bought
+ * @return  False if the product doesn't exist or there is not enough stock
+ */
+bool addProductToCart(const string & userid, CatalogCacheEntry & catalog, int productId, int quantity) {
+    while (true) {
+        // the stock is checked and taken, and the cart line written, with one snapshot
+        CatalogReader snapshot(catalog);
+        SizeType index = snapshot->find(productId);
+
+        if (index >= snapshot->size || quantity <= 0)
+            return false;
+
+        ReserveResult result = inventoryReserve(catalog, *snapshot, index, quantity);
+
+        if (result == NOT_ENOUGH_STOCK)
+            return false;
+
+        if (result == RESERVED) {
+            // append the product details into the cart of the user
+            cartAddLine(userid, snapshot->name(index), quantity, snapshot->price[index]);
+            cartTookStock(userid, catalog.filepath);
+            return true;
+        }
+
+        // a restock replaced the snapshot, take the next one once it's published
+        this_thread::yield();
+    }
+}
+
+/**
+ * @brief  Sum up the amount of every item in a cart, with the fastest
+ *         kernel the processor supports
+ * @param  cart  The quantity and price columns of a cart
+ * @return  The total amount to pay
+ */
+double cartTotal(const CartColumns & cart) {
+    static const CartTotalKernel kernel = cartTotalSelect();
+
+    return kernel(cart.quantity.data(), cart.price.data(), cart.quantity.size());
+}
+
+/**
+ * @brief  Choose the kernel of cartTotal for the processor running the program
+ * @return  The widest vector kernel supported, or the scalar one
+ */
+CartTotalKernel cartTotalSelect() {
+#ifdef CART_TOTAL_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx"))
+        return cartTotalAvx;
+    if (__builtin_cpu_supports("sse2"))
+        return cartTotalSse2;
+#endif
+    return cartTotalScalar;
+}
+
+/**
+ * @brief  Sum up quantity * price of the lines of a cart one at a time. The
+ *         lines are added into four partial sums in the same order as the
+ *         vector kernels, so the total doesn't depend on the processor
+ * @param  quantity  The quantity of each line
+ * @param  price  The unit price of each line
+ * @param  count  The number of lines
+ * @return  The total amount of the lines
+ */
+double cartTotalScalar(const int * quantity, const double * price, size_t count) {
+    double sums[4] = {0.0, 0.0, 0.0, 0.0};
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        for (int lane = 0; lane < 4; lane++)
+            sums[lane] += quantity[i + lane] * price[i + lane];
+    }
+
+    double total = (sums[0] + sums[2]) + (sums[1] + sums[3]);
+
+    for (; i < count; i++)
+        total += quantity[i] * price[i];
+
+    return total;
+}
+
+#ifdef CART_TOTAL_SIMD
+/**
+ * @brief  Sum up quantity * price of the lines of a cart two lines per
+ *         instruction with SSE2
+ * @param  quantity  The quantity of each line
+ * @param  price  The unit price of each line
+ * @param  count  The number of lines
+ * @return  The total amount of the lines
+ */
+__attribute__((target("sse2")))
+double cartTotalSse2(const int * quantity, const double * price, size_t count) {
+    __m128d low = _mm_setzero_pd();
+    __m128d high = _mm_setzero_pd();
+    size_t i = 0;
+
+    // partial sums 0, 1 in low and 2, 3 in high
+    for (; i + 4 <= count; i += 4) {
+        __m128i qty = _mm_loadu_si128((const __m128i *) (quantity + i));
+
+        low = _mm_add_pd(low, _mm_mul_pd(_mm_cvtepi32_pd(qty), _mm_loadu_pd(price + i)));
+        high = _mm_add_pd(high, _mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(qty, qty)),
+                                           _mm_loadu_pd(price + i + 2)));
+    }
+
+    __m128d half = _mm_add_pd(low, high);
+    double total = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+
+    for (; i < count; i++)
+        total += quantity[i] * price[i];
+
+    return total;
+}
+
+/**
+ * @brief  Sum up quantity * price of the lines of a cart four lines per
+ *         instruction with AVX
+ * @param  quantity  The quantity of each line
+ * @param  price  The unit price of each line
+ * @param  count  The number of lines
+ * @return  The total amount of the lines
+ */
+__attribute__((target("avx")))
+double cartTotalAvx(const int * quantity, const double * price, size_t count) {
+    __m256d sums = _mm256_setzero_pd();
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m256d qty = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *) (quantity + i)));
+
+        sums = _mm256_add_pd(sums, _mm256_mul_pd(qty, _mm256_loadu_pd(price + i)));
+    }
+
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(sums), _mm256_extractf128_pd(sums, 1));
+    double total = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+
+    for (; i < count; i++)
+        total += quantity[i] * price[i];
+
+    return total;
+}
+#endif
+
+/**
+ * @brief  Read a json file and parse it into a DOM(document object model)
+ * @param  readPath  The location of a json file
+ * @return  The DOM of a json object
+ */ 
+Document readJsonFile(string readPath) {
+    fstream file(readPath, ios::in);
+    IStreamWrapper isw(file);
+
+    Document doc;
+    doc.ParseStream(isw);
+
+    return doc;
+}
+
+/**
+ * @brief  Read a json file into memory and parse it in-situ, so the strings
+ *         of the DOM point into the buffer instead of being copied. The file
+ *         is read once into a buffer of our own, a file rewritten meanwhile
+ *         gives a parse error rather than a torn or vanishing buffer
+ * @param  readPath  The location of a json file
+ * @param  doc  The DOM to parse into
+ * @param  buffer  The buffer that owns the strings of the DOM, it must
+ *                 outlive the DOM
+ * @return  False if the file cannot be read
+ */
+bool readJsonFileInsitu(string readPath, Document & doc, FileBuffer & buffer) {
+    ifstream file(readPath, ios::in | ios::binary | ios::ate);
+
+    if (!file.is_open())
+        return false;
+
+    streamoff fileSize = file.tellg();
+
+    if (fileSize < 0)
+        return false;
+
+    // one zero byte after the content of file, since in-situ
+    // parsing needs a null terminated string
+    buffer.data.reset(new char[fileSize + 1]);
+    file.seekg(0);
+    file.read(buffer.data.get(), fileSize);
+    buffer.length = file.gcount();
+    buffer.data[buffer.length] = '\0';
+
+    doc.ParseInsitu(buffer.data.get());
+
+    return true;
+}
+
+/**
+ * @brief  Get a location next to a file that no other process or thread uses,
+ *         for preparing a file that replaces it
+ * @param  path  The location of the file
+ * @return  The location made unique by the process id and a counter,
+ *          exp: "data/biscuit.json.4242.7"
+ */
+string uniquePath(const string & path) {
+    static atomic<unsigned long> counter{0};
+
+#ifdef _WIN32
+    long pid = _getpid();
+#else
+    long pid = getpid();
+#endif
+
+    return path + '.' + to_string(pid) + '.' + to_string(++counter);
+}
+
+/**
+ * @brief  Write and save a json file
+ * @param  doc  The DOM of a json object
+ * @param  savePath  The save location of a json file
+ * @return  False if the file couldn't be written, the old file is kept then
+ */
+bool writeJsonFile(Document& doc, string savePath) {
+    string tempPath = savePath + ".tmp";
+    error_code ec;
+
+    {
+        fstream file(tempPath, ios::out);
+        OStreamWrapper osw(file);
+
+        PrettyWriter<OStreamWrapper> writer(osw);
+        doc.Accept(writer);
+
+        // a full disk is only seen once the buffer is written out
+        file.close();
+        if (file.fail()) {
+            filesystem::remove(tempPath, ec);
+            return false;
+        }
+    }
+
+    // replace the old file instead of truncating it, so a reader
+    // never sees it half written
+    filesystem::rename(tempPath, savePath, ec);
+    if (ec) {
+        filesystem::remove(tempPath, ec);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief  Have a file written in the background by the persister, no later than
+ *         PERSIST_STALENESS_MS from now. If the file is already waiting, the new
+ *         write replaces the old one and keeps its time
+ * @param  filepath  The location of the file, the key of the write
+ * @param  write     Write the file with its latest state
+ */
+void persistQueue(const string & filepath, function<bool()> write) {
+    static once_flag started;
+
+    call_once(started, [] {
+        persister.worker = thread(persistWorker);
+        atexit(persistStop);
+    });
+
+    unique_lock<mutex> guard(persister.lock);
+
+    // nothing runs in the background once the program is exiting
+    if (persister.stopped) {
+        guard.unlock();
+        if (!write())
+            cerr << "cannot write " << filepath << '\n';
+        return;
+    }
+
+    auto [it, inserted] = persister.pending.try_emplace(filepath);
+
+    it->second.write = move(write);
+    it->second.ticket = persister.files[filepath].queued = ++persister.queued;
+
+    if (inserted) {
+        it->second.due = chrono::steady_clock::now() + chrono::milliseconds(PERSIST_STALENESS_MS);
+        persister.wake.notify_one();
+    }
+}
+
+/**
+ * @brief  Write the queued files when they are due, a barrier makes the files
+ *         it waits for due at once, until the persister is stopped
+ */
+void persistWorker() {
+    unique_lock<mutex> guard(persister.lock);
+
+    while (true) {
+        auto now = chrono::steady_clock::now();
+        vector<pair<string, PersistJob>> round;
+
+        for (auto it = persister.pending.begin(); it != persister.pending.end(); ) {
+            if (persister.stopping || it->second.due <= now) {
+                round.emplace_back(it->first, move(it->second));
+                it = persister.pending.erase(it);
+            }
+            else
+                it++;
+        }
+
+        if (round.empty()) {
+            if (persister.stopping)
+                break;
+
+            // sleep until the first write is due, a new write or a barrier
+            auto due = chrono::steady_clock::time_point::max();
+
+            for (auto & [filepath, job] : persister.pending)
+                due = min(due, job.due);
+
+            persister.wake.wait_until(guard, due);
+            continue;
+        }
+
+        guard.unlock();
+
+        vector<bool> succeeded(round.size());
+
+        for (size_t i = 0; i < round.size(); i++)
+            succeeded[i] = round[i].second.write();
+
+        guard.lock();
+
+        for (size_t i = 0; i < round.size(); i++) {
+            auto & [filepath, job] = round[i];
+            PersistProgress & file = persister.files[filepath];
+
+            if (succeeded[i]) {
+                file.written = max(file.written, job.ticket);
+                continue;
+            }
+
+            // the barriers waiting for this write fail, the ones after
+            // wait for it to be tried again later, unless a newer state
+            // of the file is waiting already
+            file.failed = max(file.failed, job.ticket);
+            if (persister.stopping)
+                cerr << "cannot write " << filepath << '\n';
+            else if (!persister.pending.count(filepath)) {
+                job.due = chrono::steady_clock::now() + chrono::milliseconds(PERSIST_STALENESS_MS);
+                job.ticket = file.queued = ++persister.queued;
+                persister.pending.emplace(filepath, move(job));
+            }
+        }
+
+        persister.written.notify_all();
+    }
+
+    persister.stopped = true;
+    persister.written.notify_all();
+}
+
+/**
+ * @brief  Wait until the writes queued so far of some files are done, the
+ *         barrier of a payment: the stock it took is on disk before the
+ *         receipt is given. The writes of other files are not waited for
+ * @param  filepaths  The locations of the files
+ * @return  False if one of them couldn't be written, it is tried again later
+ */
+bool persistFlush(const vector<string> & filepaths) {
+    unique_lock<mutex> guard(persister.lock);
+    vector<pair<const PersistProgress *, long>> targets;
+    auto now = chrono::steady_clock::now();
+
+    for (const string & filepath : filepaths) {
+        auto file = persister.files.find(filepath);
+
+        // never queued, or written already
+        if (file == persister.files.end() || file->second.written >= file->second.queued)
+            continue;
+
+        targets.emplace_back(&file->second, file->second.queued);
+
+        // a write still waiting is due now, one being written is waited for
+        auto job = persister.pending.find(filepath);
+
+        if (job != persister.pending.end())
+            job->second.due = now;
+    }
+
+    auto done = [&targets] {
+        for (auto & [file, ticket] : targets) {
+            if (file->written < ticket && file->failed < ticket)
+                return false;
+        }
+        return true;
+    };
+
+    // once stopped, the files are written as they are queued
+    if (!persister.stopped) {
+        persister.wake.notify_one();
+        persister.written.wait(guard, [&done] { return done() || persister.stopped; });
+    }
+
+    for (auto & [file, ticket] : targets) {
+        if (file->written < ticket)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief  Wait until every file queued so far is written
+ * @return  False if a file couldn't be written, it is tried again later
+ */
+bool persistFlush() {
+    vector<string> filepaths;
+
+    {
+        lock_guard<mutex> guard(persister.lock);
+
+        for (auto & [filepath, file] : persister.files)
+            filepaths.push_back(filepath);
+    }
+
+    return persistFlush(filepaths);
+}
+
+/**
+ * @brief  Write every queued file and stop the persister, registered with
+ *         atexit when the persister starts and called by a server stopped
+ *         with a signal
+ */
+void persistStop() {
+    {
+        lock_guard<mutex> guard(persister.lock);
+        persister.stopping = true;
+    }
+
+    persister.wake.notify_one();
+    if (persister.worker.joinable())
+        persister.worker.join();
+}
+
+/**
+ * @brief  Get a catalog file from the catalog cache. The file is only read and
+ *         parsed again when its modified time or size changed, no lock is
+ *         taken unless it is
+ * @param  filepath  The location of a catalog json file
+ * @return  The cached catalog, an empty one if the file was never valid
+ */
+CatalogCacheEntry & loadCatalog(string filepath) {
+    error_code ec;
+    filesystem::file_time_type modifiedTime = filesystem::last_write_time(filepath, ec);
+    uintmax_t fileSize = filesystem::file_size(filepath, ec);
+
+    // reuse the snapshot if the file has not been changed since it was loaded,
+    // or the change is the stock being written back by ourselves
+    auto unchanged = [&](const CatalogCacheEntry * cached) {
+        return cached != nullptr && (cached->writing || (!ec &&
+            cached->modifiedTime == modifiedTime.time_since_epoch().count() && cached->fileSize == fileSize));
+    };
+
+    CatalogCacheEntry * cached = catalogFind(filepath);
+
+    if (unchanged(cached))
+        return *cached;
+
+    lock_guard<mutex> loading(catalogLock);
+
+    // another thread may have loaded it while we waited
+    cached = catalogFind(filepath);
+    if (unchanged(cached))
+        return *cached;
+
+    FileBuffer buffer;
+    Document doc;
+    string error;
+
+    if (!catalogParse(filepath, doc, buffer, error)) {
+        cerr << filepath << ": " << error << '\n';
+
+        // keep selling from what was loaded before, the file is
+        // read again when it's changed
+        if (cached != nullptr) {
+            cached->modifiedTime = modifiedTime.time_since_epoch().count();
+            cached->fileSize = fileSize;
+            return *cached;
+        }
+
+        doc.Parse("{\"category\": \"\", \"products\": []}");
+    }
+
+    return catalogInstall(filepath, doc, modifiedTime, fileSize);
+}
+
+/**
+ * @brief  Find a catalog in the catalog cache without any lock
+ * @param  filepath  The location of a catalog json file
+ * @return  The cached catalog, nullptr if it has never been loaded
+ */
+CatalogCacheEntry * catalogFind(const string & filepath) {
+    HazardSlot * slot = hazardAcquire();
+    const CatalogIndex * index = hazardProtect(slot, catalogCache);
+    auto it = index->find(filepath);
+    CatalogCacheEntry * entry = it != index->end() ? it->second : nullptr;
+
+    hazardRelease(slot);
+    return entry;
+}
+
+/**
+ * @brief  Find every catalog file in the catalog folder, parse and validate them
+ *         in parallel and put the valid ones into the catalog cache, so a broken
+ *         catalog is reported when the program starts instead of during a sale
+ * @return  False if any catalog file is invalid
+ */
+bool catalogPreload() {
+    vector<string> names = catalogDiscover();
+    vector<string> errors(names.size());
+    vector<string> titles(names.size());
+    atomic<size_t> next{0};
+
+    // every thread takes the next file that nobody is parsing yet, so a
+    // large catalog doesn't hold up the files behind it
+    auto parseCatalogs = [&] {
+        for (size_t i; (i = next.fetch_add(1)) < names.size(); ) {
+            string filepath = catalogPath(names[i]);
+            error_code ec;
+            filesystem::file_time_type modifiedTime = filesystem::last_write_time(filepath, ec);
+            uintmax_t fileSize = filesystem::file_size(filepath, ec);
+            FileBuffer buffer;
+            Document doc;
+
+            if (!catalogParse(filepath, doc, buffer, errors[i]))
+                continue;
+
+            titles[i] = doc["category"].GetString();
+
+            lock_guard<mutex> loading(catalogLock);
+
+            catalogInstall(filepath, doc, modifiedTime, fileSize);
+        }
+    };
+
+    unsigned workers = min<size_t>(max(1u, thread::hardware_concurrency()), names.size());
+    vector<thread> parsers;
+
+    for (unsigned w = 1; w < workers; w++)
+        parsers.emplace_back(parseCatalogs);
+    parseCatalogs();
+    for (thread & parser : parsers)
+        parser.join();
+
+#ifdef __GLIBC__
+    // the DOMs the columns were built from are freed, give their
+    // memory back instead of keeping it in the heap of each parser
+    malloc_trim(0);
+#endif
+
+    catalogCategories.clear();
+
+    for (size_t i = 0; i < names.size(); i++) {
+        if (errors[i].empty())
+            catalogCategories.push_back({names[i], titles[i]});
+        else
+            cerr << catalogPath(names[i]) << ": " << errors[i] << '\n';
+    }
+
+    return catalogCategories.size() == names.size();
+}
+
+/**
+ * @brief  List the catalog files in the catalog folder, a catalog is a json
+ *         file whose name is a valid category name
+ * @return  The names of the categories, sorted
+ */
+vector<string> catalogDiscover() {
+    vector<string> names;
+    error_code ec;
+
+    for (filesystem::directory_iterator it(CATALOG_DIR_PATH, ec), end; !ec && it != end; it.increment(ec)) {
+        const filesystem::path & path = it->path();
+        string name = path.stem().string();
+
+        // the carts of before they were sharded are not a catalog
+        if (path.extension() == ".json" && validCategoryName(name) &&
+            path != filesystem::path(LEGACY_CART_FILE_PATH) && it->is_regular_file(ec))
+            names.push_back(name);
+    }
+
+    sort(names.begin(), names.end());
+    return names;
+}
+
+/**
+ * @brief  Read a catalog file and check it against the catalog schema. Safe
+ *         to call from many threads at once
+ * @param  filepath  The location of a catalog json file
+ * @param  doc       Receive the DOM of the catalog
+ * @param  buffer    Receive the content of the file if it was parsed in-situ
+ * @param  error     Receive the reason the catalog is invalid
+ * @return  False if the file can't be parsed or doesn't match the schema
+ */
+bool catalogParse(const string & filepath, Document & doc, FileBuffer & buffer, string & error) {
+    // built once, the schema document is only read by the validators
+    static const SchemaDocument schema = [] {
+        Document schemaDoc;
+
+        schemaDoc.Parse(catalogSchema);
+        return SchemaDocument(schemaDoc);
+    }();
+
+    // prefer the in-situ parse, fall back to the stream parse
+    if (!readJsonFileInsitu(filepath, doc, buffer)) {
+        error_code ec;
+
+        if (!filesystem::exists(filepath, ec)) {
+            error = "no such file";
+            return false;
+        }
+
+        doc = readJsonFile(filepath);
+    }
+
+    if (doc.HasParseError()) {
+        error = string(GetParseError_En(doc.GetParseError())) + " at offset " + to_string(doc.GetErrorOffset());
+        return false;
+    }
+
+    SchemaValidator validator(schema);
+
+    if (!doc.Accept(validator)) {
+        StringBuffer pointer;
+
+        validator.GetInvalidDocumentPointer().StringifyUriFragment(pointer);
+        error = string("\"") + validator.GetInvalidSchemaKeyword() + "\" not met at " + pointer.GetString();
+        return false;
+    }
+
+    // a product is found by its id, so no two products may share one
+    const Value & products = doc["products"];
+    vector<int> ids;
+
+    ids.reserve(products.Size());
+    for (const auto & product : products.GetArray())
+        ids.push_back(product["id"].GetInt());
+    sort(ids.begin(), ids.end());
+
+    auto twice = adjacent_find(ids.begin(), ids.end());
+
+    if (twice != ids.end()) {
+        error = "product id " + to_string(*twice) + " is used more than once";
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief  Publish a parsed catalog as the current snapshot of its cache entry,
+ *         the entry is added to the cache if it's new. The catalog lock must
+ *         be held, readers go on with the old snapshot until they let it go
+ * @param  filepath      The location of the catalog file
+ * @param  doc           The DOM of the catalog, only read while the snapshot is built
+ * @param  modifiedTime  The modified time of the file before it was read
+ * @param  fileSize      The size of the file before it was read
+ * @return  The cache entry of the catalog
+ */
+CatalogCacheEntry & catalogInstall(const string & filepath, const Document & doc,
+                                   filesystem::file_time_type modifiedTime, uintmax_t fileSize) {
+    const CatalogIndex * index = catalogCache.load();
+    auto it = index->find(filepath);
+    bool added = it == index->end();
+    CatalogCacheEntry & entry = added ? catalogEntries.emplace_back() : *it->second;
+    const CatalogSnapshot * previous = entry.current.load();
+    CatalogSnapshot * snapshot = new CatalogSnapshot;
+    Document::AllocatorType & allocator = snapshot->head.GetAllocator();
+
+    const Value & products = doc["products"];
+    auto version = doc.FindMember("version");
+    bool sold = false;
+    bool extra = false;
+
+    // copied, the DOM and the buffer its strings point into are freed
+    // by the caller once the snapshot is built
+    snapshot->head.SetObject();
+    for (const auto & member : doc.GetObject()) {
+        if (member.name != "version" && member.name != "products")
+            snapshot->head.AddMember(Value(member.name, allocator, true), Value(member.value, allocator, true), allocator);
+    }
+
+    snapshot->size = products.Size();
+    snapshot->id.resize(snapshot->size);
+    snapshot->price.resize(snapshot->size);
+    snapshot->nameOffset.resize(snapshot->size);
+
+    for (SizeType i = 0; i < snapshot->size; i++) {
+        const Value & name = products[i]["name"];
+
+        snapshot->id[i] = products[i]["id"].GetInt();
+        snapshot->price[i] = products[i]["price"].GetDouble();
+        snapshot->nameOffset[i] = snapshot->names.size();
+        snapshot->names.append(name.GetString(), name.GetStringLength());
+        snapshot->names.push_back('\0');
+        extra = extra || products[i].MemberCount() > 4;
+    }
+
+    // only a catalog whose products are not in the order of their ids
+    // pays for the index
+    if (!is_sorted(snapshot->id.begin(), snapshot->id.end())) {
+        snapshot->byId.resize(snapshot->size);
+        for (SizeType i = 0; i < snapshot->size; i++)
+            snapshot->byId[i] = i;
+        sort(snapshot->byId.begin(), snapshot->byId.end(),
+             [snapshot](SizeType a, SizeType b) { return snapshot->id[a] < snapshot->id[b]; });
+    }
+
+    // only a catalog with more than the four members per product pays
+    // for keeping them
+    if (extra) {
+        Document::AllocatorType & extraAllocator = snapshot->extra.GetAllocator();
+
+        snapshot->extra.SetArray().Reserve(snapshot->size, extraAllocator);
+        for (const auto & product : products.GetArray()) {
+            Value members(kObjectType);
+
+            for (const auto & member : product.GetObject()) {
+                if (member.name != "id" && member.name != "name" && member.name != "quantity" && member.name != "price")
+                    members.AddMember(Value(member.name, extraAllocator, true),
+                                      Value(member.value, extraAllocator, true), extraAllocator);
+            }
+            snapshot->extra.PushBack(members, extraAllocator);
+        }
+    }
+
+    // sellers read the path of a published entry to queue its write
+    if (added)
+        entry.filepath = filepath;
+    entry.version = version != doc.MemberEnd() && version->value.IsInt64() ? version->value.GetInt64() : 0;
+
+    // the stock is the quantities in the file, less what we sold but haven't
+    // written yet when the file was changed by another process, matched by
+    // the id of product. Each counter of the previous snapshot is sealed as
+    // its stock is moved over, so no sale is lost, and a reserve finding it
+    // sealed takes the new snapshot. Readers go on reading the previous
+    // snapshot meanwhile
+    unique_ptr<int[]> baseline(new int[snapshot->size]);
+
+    snapshot->stock.reset(new atomic<int64_t>[snapshot->size]);
+    for (SizeType i = 0; i < snapshot->size; i++) {
+        SizeType before = previous != nullptr ? previous->find(snapshot->id[i]) : 0;
+        int64_t unwritten = 0;
+
+        if (previous != nullptr && before < previous->size)
+            unwritten = previous->stock[before].fetch_add(STOCK_SEALED, memory_order_relaxed) - entry.baseline[before];
+
+        baseline[i] = products[i]["quantity"].GetInt();
+        sold = sold || unwritten != 0;
+        snapshot->stock[i].store(baseline[i] + unwritten, memory_order_relaxed);
+    }
+
+    // the products gone from the file can't be sold any more, only
+    // the writers seal a counter
+    for (SizeType i = 0; previous != nullptr && i < previous->size; i++) {
+        if (previous->stock[i].load(memory_order_relaxed) < STOCK_SEALED / 2)
+            previous->stock[i].fetch_add(STOCK_SEALED, memory_order_relaxed);
+    }
+
+    entry.baseline = move(baseline);
+    entry.modifiedTime = modifiedTime.time_since_epoch().count();
+    entry.fileSize = fileSize;
+
+    // readers take the new snapshot from now on, the old one is
+    // freed once the last of its readers is done
+    entry.current.store(snapshot);
+    if (previous != nullptr)
+        hazardRetire(previous, [](const void * old) { delete (const CatalogSnapshot *) old; });
+
+    // a new catalog is published with a copy of the index
+    if (added) {
+        CatalogIndex * next = new CatalogIndex(*index);
+
+        (*next)[filepath] = &entry;
+        catalogCache.store(next);
+        hazardRetire(index, [](const void * old) { delete (const CatalogIndex *) old; });
+    }
+
+    // a queued write is left alone even if nothing is left unwritten here,
+    // a sale made since the scan above may be waiting on it. Only the write
+    // clears the dirty flag. A write merging the file commits the sales itself
+    if (sold && !entry.writing)
+        inventoryChanged(entry);
+
+    return entry;
+}
+
+/**
+ * @brief  Take a hazard slot for the reading thread, a slot the thread has
+ *         given back before is taken first
+ * @return  The slot, it holds nothing yet
+ */
+HazardSlot * hazardAcquire() {
+    if (!hazardCache.free.empty()) {
+        HazardSlot * slot = hazardCache.free.back();
+
+        hazardCache.free.pop_back();
+        return slot;
+    }
+
+    // a slot left by a thread that exited, or a new one
+    for (HazardSlot * slot = hazards.slots.load(memory_order_acquire); slot != nullptr; slot = slot->next) {
+        bool unused = false;
+
+        if (!slot->used.load(memory_order_relaxed) &&
+            slot->used.compare_exchange_strong(unused, true, memory_order_acquire))
+            return slot;
+    }
+
+    HazardSlot * slot = new HazardSlot;
+
+    slot->used.store(true, memory_order_relaxed);
+    slot->next = hazards.slots.load(memory_order_relaxed);
+    while (!hazards.slots.compare_exchange_weak(slot->next, slot, memory_order_release, memory_order_relaxed));
+
+    return slot;
+}
+
+/**
+ * @brief  Stop holding a pointer and keep the slot for the next reader of the thread
+ * @param  slot  The hazard slot
+ */
+void hazardRelease(HazardSlot * slot) {
+    slot->pointer.store(nullptr, memory_order_release);
+    hazardCache.free.push_back(slot);
+}
+
+/**
+ * @brief  Read a pointer published by the writers and hold it in a hazard slot
+ * @param  slot    The hazard slot of the reader
+ * @param  source  The published pointer
+ * @return  The pointer, not freed until the slot holds something else
+ */
+template<typename T>
+T * hazardProtect(HazardSlot * slot, const atomic<T *> & source) {
+    T * pointer = source.load(memory_order_relaxed);
+
+    // the writer may have replaced and retired it before the slot was set,
+    // it is safe once it's still published after the slot is visible
+    while (true) {
+        slot->pointer.store(pointer);
+
+        T * published = source.load();
+
+        if (published == pointer)
+            return pointer;
+        pointer = published;
+    }
+}
+
+/**
+ * @brief  Free an object replaced by a writer once no reader holds it, and
+ *         the objects retired before that no reader holds any more. The
+ *         catalog lock must be held
+ * @param  object  The object that is no longer published
+ * @param  free    Delete the object
+ */
+void hazardRetire(const void * object, void (*free)(const void *)) {
+    vector<const void *> held;
+
+    hazards.retired.emplace_back(object, free);
+
+    for (HazardSlot * slot = hazards.slots.load(); slot != nullptr; slot = slot->next) {
+        if (const void * pointer = slot->pointer.load())
+            held.push_back(pointer);
+    }
+    sort(held.begin(), held.end());
+
+    size_t kept = 0;
+
+    for (auto & retired : hazards.retired) {
+        if (binary_search(held.begin(), held.end(), retired.first))
+            hazards.retired[kept++] = retired;
+        else
+            retired.second(retired.first);
+    }
+
+    hazards.retired.resize(kept);
+}
+
+CatalogReader::CatalogReader(const CatalogCacheEntry & catalog)
+    : slot(hazardAcquire()), snapshot(hazardProtect(slot, catalog.current)) {}
+
+CatalogReader::~CatalogReader() {
+    hazardRelease(slot);
+}
+
+HazardCache::~HazardCache() {
+    for (HazardSlot * slot : free)
+        slot->used.store(false, memory_order_release);
+}
+
+/**
+ * @brief  Take a quantity of a product out of the stock of a snapshot if there
+ *         is enough of it. Lock free, readers of the stock are never blocked
+ * @param  catalog   The cached catalog
+ * @param  snapshot  The snapshot of the catalog the caller took the product from
+ * @param  index     The index of the product in the catalog
+ * @param  quantity  The quantity to take
+ * @return  NOT_ENOUGH_STOCK if the stock is less than the quantity or the product
+ *          doesn't exist, SNAPSHOT_REPLACED if a restock has replaced the
+ *          snapshot. Nothing is taken unless RESERVED
+ */
+ReserveResult inventoryReserve(CatalogCacheEntry & catalog, const CatalogSnapshot & snapshot,
+                               SizeType index, int quantity) {
+    if (index >= snapshot.size)
+        return NOT_ENOUGH_STOCK;
+
+    atomic<int64_t> & stock = snapshot.stock[index];
+    int64_t current = stock.load(memory_order_relaxed);
+
+    // on failure current is reloaded with the stock set by another thread
+    do {
+        if (current >= STOCK_SEALED / 2)
+            return SNAPSHOT_REPLACED;
+        if (current < quantity)
+            return NOT_ENOUGH_STOCK;
+    } while (!stock.compare_exchange_weak(current, current - quantity, memory_order_relaxed));
+
+    inventoryChanged(catalog);
+    return RESERVED;
+}
+
+/**
+ * @brief  Put a quantity of a product back into stock
+ * @param  catalog   The cached catalog
+ * @param  index     The index of the product in the catalog
+ * @param  quantity  The quantity to put back
+ */
+void inventoryRelease(CatalogCacheEntry & catalog, int productId, int quantity) {
+    while (true) {
+        // the product may have moved in the next snapshot
+        CatalogReader snapshot(catalog);
+        SizeType index = snapshot->find(productId);
+
+        if (index >= snapshot->size)
+            return;
+
+        atomic<int64_t> & stock = snapshot->stock[index];
+        int64_t current = stock.load(memory_order_relaxed);
+
+        // put back into the snapshot the stock has been moved to
+        while (current < STOCK_SEALED / 2 &&
+               !stock.compare_exchange_weak(current, current + quantity, memory_order_relaxed));
+
+        if (current < STOCK_SEALED / 2)
+            break;
+
+        this_thread::yield();
+    }
+
+    inventoryChanged(catalog);
+}
+
+/**
+ * @brief  Have the stock of a catalog written back to its file in the background
+ * @param  catalog  The cached catalog whose stock has changed
+ */
+void inventoryChanged(CatalogCacheEntry & catalog) {
+    // only the first change since the stock was written queues a write, read
+    // first so the hot path doesn't keep writing the shared flag
+    if (!catalog.dirty.load(memory_order_relaxed) && !catalog.dirty.exchange(true))
+        persistQueue(catalog.filepath, [&catalog] { return inventoryWrite(catalog); });
+}
+
+/**
+ * @brief  Write the stock of a catalog back to its file, run by the persister.
+ *         The readers of the catalog are not blocked while the file is written
+ * @param  catalog  The cached catalog
+ * @return  False if the file couldn't be written or kept being changed by other processes
+ */
+bool inventoryWrite(CatalogCacheEntry & catalog) {
+    int attempt = 0;
+
+    // cleared before the stock is read, a sale made while the
+    // file is written queues the catalog again
+    if (!catalog.dirty.exchange(false))
+        return true;
+
+    catalog.writing = true;
+
+    // another process wrote the file since we read it, take its changes
+    // and try again
+    while (!catalogCommit(catalog.filepath, catalog)) {
+        if (++attempt == CATALOG_COMMIT_RETRIES || !catalogMerge(catalog.filepath)) {
+            catalog.dirty = true;
+            catalog.writing = false;
+            return false;
+        }
+    }
+
+    catalog.writing = false;
+    return true;
+}
+
+/**
+ * @brief  Write the current stock of a catalog to its file if the file still has
+ *         the version it had when we read or wrote it last (compare and swap).
+ *         The file is prepared without any lock at a location of its own, only
+ *         the check of version and the replace of file are done under the lock
+ *         file of the catalog
+ * @param  filepath  The location of the catalog file
+ * @param  catalog   The cached catalog
+ * @return  False if another process has written the file in between or the
+ *          file couldn't be written, the version and stock stay as they were
+ */
+bool catalogCommit(const string & filepath, CatalogCacheEntry & catalog) {
+    // each commit stages its own file, so two lanes committing at
+    // once can't overwrite or tear each other's document
+    string nextPath = uniquePath(filepath + ".next");
+    Document next;
+    Document::AllocatorType & allocator = next.GetAllocator();
+    vector<pair<int, int>> written;     // the id and quantity of each product
+    long version;
+    error_code ec;
+
+    {
+        // readers go on, only the other writers wait
+        lock_guard<mutex> building(catalogLock);
+        const CatalogSnapshot * snapshot = catalog.current.load();
+
+        version = catalog.version;
+
+        // the version is the first member, so it can be read without parsing the file
+        next.SetObject();
+        next.AddMember("version", (int64_t) version + 1, allocator);
+        for (const auto & member : snapshot->head.GetObject())
+            next.AddMember(Value(member.name, allocator, true), Value(member.value, allocator, true), allocator);
+
+        // the products are written from the columns of the snapshot
+        Value products(kArrayType);
+
+        products.Reserve(snapshot->size, allocator);
+        written.resize(snapshot->size);
+        for (SizeType i = 0; i < snapshot->size; i++) {
+            Value product(kObjectType);
+
+            written[i] = {snapshot->id[i], snapshot->quantity(i)};
+            product.AddMember("id", written[i].first, allocator);
+            product.AddMember("name", Value(snapshot->name(i), allocator), allocator);
+            product.AddMember("quantity", written[i].second, allocator);
+            product.AddMember("price", snapshot->price[i], allocator);
+            if (snapshot->extra.IsArray()) {
+                for (const auto & member : snapshot->extra[i].GetObject())
+                    product.AddMember(Value(member.name, allocator, true), Value(member.value, allocator, true), allocator);
+            }
+            products.PushBack(product, allocator);
+        }
+        next.AddMember("products", products, allocator);
+    }
+
+    if (!writeJsonFile(next, nextPath))
+        return false;
+
+    filesystem::file_time_type modifiedTime;
+    uintmax_t fileSize;
+
+    {
+        FileLock lock((filepath + ".lock").c_str());
+
+        if (readDocumentVersion(filepath) != version) {
+            filesystem::remove(nextPath, ec);
+            return false;
+        }
+
+        filesystem::rename(nextPath, filepath, ec);
+        if (ec) {
+            filesystem::remove(nextPath, ec);
+            return false;
+        }
+
+        // stamped before another process can commit over our file, a
+        // stamp that can't be read only makes the next load parse it
+        modifiedTime = filesystem::last_write_time(filepath, ec);
+        fileSize = filesystem::file_size(filepath, ec);
+    }
+
+    // record the new version and stamp so the cache stays valid
+    lock_guard<mutex> stamping(catalogLock);
+
+    catalog.version = version + 1;
+
+    // the products are matched by id, a reload may have changed them meanwhile
+    const CatalogSnapshot * current = catalog.current.load();
+
+    sort(written.begin(), written.end());
+    for (SizeType i = 0; i < current->size; i++) {
+        auto product = lower_bound(written.begin(), written.end(), make_pair(current->id[i], numeric_limits<int>::min()));
+
+        if (product != written.end() && product->first == current->id[i])
+            catalog.baseline[i] = product->second;
+    }
+    catalog.modifiedTime = modifiedTime.time_since_epoch().count();
+    catalog.fileSize = fileSize;
+
+    return true;
+}
+
+/**
+ * @brief  Take the stock changes another process has written to a catalog file
+ *         into our stock, keeping what we sold since our last read or write.
+ *         The products may have been added or removed too
+ * @param  filepath  The location of the catalog file
+ * @return  False if the file can't be read or is not a valid catalog
+ */
+bool catalogMerge(const string & filepath) {
+    error_code ec;
+    filesystem::file_time_type modifiedTime = filesystem::last_write_time(filepath, ec);
+    uintmax_t fileSize = filesystem::file_size(filepath, ec);
+    FileBuffer buffer;
+    Document current;
+    string error;
+
+    if (!catalogParse(filepath, current, buffer, error)) {
+        cerr << "cannot merge the stock of " << filepath << ": " << error << '\n';
+        return false;
+    }
+
+    lock_guard<mutex> merging(catalogLock);
+
+    catalogInstall(filepath, current, modifiedTime, fileSize);
+    return true;
+}
+
+/**
+ * @brief  Read the version of a json document file, written as its first member
+ * @param  filepath  The location of the file
+ * @return  The version, 0 for a file written before documents had a version
+ */
+long readDocumentVersion(const string & filepath) {
+    char head[256] = {};
+    fstream file(filepath, ios::in | ios::binary);
+
+    file.read(head, sizeof(head) - 1);
+
+    const char * key = strstr(head, "\"version\"");
+    const char * colon = key ? strchr(key, ':') : nullptr;
+
+    if (colon)
+        return strtol(colon + 1, nullptr, 10);
+
+    // the version is not at the head of a file written by hand
+    Document doc = readJsonFile(filepath);
+    auto version = doc.IsObject() ? doc.FindMember("version") : doc.MemberEnd();
+
+    return doc.IsObject() && version != doc.MemberEnd() && version->value.IsInt64() ? version->value.GetInt64() : 0;
+}
+
+/** 
+ * @brief  Find and return the position of a user in json file
+ * @param  users  The "users" array in json file
+ * @param  userid  The userid of the user
+ */
+int jsonFindUserPosition(Value & users, string userid) {
+    // loop and check if the value of "userid" key match with the given userid
+    for (SizeType i = 0; i < users.Size(); i++) {
+        if (userid == users[i]["userid"].GetString())
+            return i;
+    }
+
+    // return -1 if user not found
+    return -1;
+}
+
+/**
+ * @brief  Create and append the info of new user into the json file
+ * @param  users  The "users" array in json file
+ * @param  newUserid  The userid of the new user
+ * @param  allocator  The allocator of DOM
+ * @return  The position of the new user in json file
+ */
+int jsonCreateNewUser(Value & users, string newUserid, Document::AllocatorType & allocator) {
+    int position = 0;
+
+    // initialize a empty value of json object
+    Value newCart(kArrayType);
+    Value newUsersObject(kObjectType);
+    Value userid(newUserid.c_str(), allocator) ;
+
+    // exp: 
+    // {
+    //    "useid": 1,
+    //    "cart": []
+    // }
+    newUsersObject.AddMember("userid", userid, allocator);
+    newUsersObject.AddMember("cart", newCart, allocator);
+
+    position = users.Size();
+    users.PushBack(newUsersObject, allocator);
+
+    return position;
+}
+
+/**
+ * @brief  Get the cart shard of a user, the shard is created the first
+ *         time the user is seen by this process
+ * @param  userid  The userid of the user
+ * @return  The cart shard of the user
+ */
+CartShard & cartShard(const string & userid) {
+    lock_guard<mutex> guard(cartStore.lock);
+
+    if (!cartStore.migrated) {
+        cartMigrateLegacy();
+        cartStore.migrated = true;
+    }
+
+    unique_ptr<CartShard> & shard = cartStore.shards[userid];
+
+    if (!shard) {
+        shard.reset(new CartShard);
+        shard->userid = userid;
+    }
+
+    return *shard;
+}
+
+/**
+ * @brief  Copy the cart of a user, the records appended to the cart journal
+ *         by this or another process are applied first. The shard may be
+ *         replayed or reloaded as soon as its lock is released, so only
+ *         the copy is handed out
+ * @param  userid  The userid of the user
+ * @param  cart  Set to a copy of the "cart" array of the user
+ */
+void cartFind(const string & userid, Document & cart) {
+    CartShard & shard = cartShard(userid);
+    lock_guard<mutex> guard(shard.lock);
+
+    cartReplayLog(shard);
+
+    cart.CopyFrom(shard.doc["cart"], cart.GetAllocator());
+}
+
+/**
+ * @brief  Get the total amount of the cart of a user
+ * @param  userid  The userid of the user
+ * @return  The total amount to pay
+ */
+double cartFindTotal(const string & userid) {
+    CartShard & shard = cartShard(userid);
+    lock_guard<mutex> guard(shard.lock);
+
+    cartReplayLog(shard);
+
+    return cartTotal(shard.columns);
+}
+
+/**
+ * @brief  Append a product to the cart of a user
+ * @param  userid  The userid of the user
+ * @param  name  The name of product
+ * @param  qty  The quantity of product
+ * @param  price  The unit price of product
+ */
+void cartAddLine(string userid, const char * name, int qty, double price) {
+    char record[64];
+
+    // price is written with enough digits to read back the same double
+    snprintf(record, sizeof(record), "A\t%s\t%d\t%.17g\t", userid.c_str(), qty, price);
+    cartAppendRecord(cartShard(userid), record + cartEscapeField(name) + '\n');
+}
+
+/**
+ * @brief  Remove a product from the cart of a user
+ * @param  userid  The userid of the user
+ * @param  id  The id of the product in cart, start from 1
+ */
+void cartRemoveLine(string userid, int id) {
+    cartAppendRecord(cartShard(userid), "R\t" + userid + '\t' + to_string(id) + '\n');
+}
+
+/**
+ * @brief  Erase all products in the cart of a user
+ * @param  userid  The userid of the user
+ */
+void cartClear(string userid) {
+    CartShard & shard = cartShard(userid);
+
+    cartAppendRecord(shard, "C\t" + userid + '\n');
+
+    lock_guard<mutex> guard(shard.lock);
+    shard.catalogs.clear();
+}
+
+/**
+ * @brief  Remember the catalog the stock of a cart line was taken from
+ * @param  userid    The userid of the user
+ * @param  filepath  The location of the catalog file
+ */
+void cartTookStock(const string & userid, const string & filepath) {
+    CartShard & shard = cartShard(userid);
+    lock_guard<mutex> guard(shard.lock);
+
+    shard.catalogs.insert(filepath);
+}
+
+/**
+ * @brief  Get the catalogs the cart of a user took stock from in this process,
+ *         the files the payment of the cart waits for
+ * @param  userid  The userid of the user
+ * @return  The locations of the catalog files
+ */
+vector<string> cartCatalogs(const string & userid) {
+    CartShard & shard = cartShard(userid);
+    lock_guard<mutex> guard(shard.lock);
+
+    return vector<string>(shard.catalogs.begin(), shard.catalogs.end());
+}
+
+/**
+ * @brief  Get the location of a file of the cart shard of a user
+ * @param  userid  The userid of the user
+ * @param  extension  ".json" for the snapshot, ".log" for the journal or ".lock" for the lock file
+ * @return  The location of the file, exp: "data/carts/1.json"
+ */
+string cartShardPath(const string & userid, const char * extension) {
+    return string(CART_DIR_PATH) + '/' + userid + extension;
+}
+
+/**
+ * @brief  Parse the snapshot of a cart shard and start applying its
+ *         journal from the beginning
+ * @param  shard  The cart shard
+ */
+void cartLoadSnapshot(CartShard & shard) {
+    shard.doc = readJsonFile(cartShardPath(shard.userid, ".json"));
+
+    Document::AllocatorType & allocator = shard.doc.GetAllocator();
+
+    // a user without snapshot has an empty cart
+    if (!shard.doc.IsObject())
+        shard.doc.SetObject();
+
+    if (!shard.doc.HasMember("cart"))
+        shard.doc.AddMember("cart", Value(kArrayType), allocator);
+
+    shard.columns.quantity.clear();
+    shard.columns.price.clear();
+
+    for (const auto & item : shard.doc["cart"].GetArray()) {
+        shard.columns.quantity.push_back(item["quantity"].GetInt());
+        shard.columns.price.push_back(item["price"].GetDouble());
+    }
+
+    shard.generation = shard.doc.HasMember("generation") ? shard.doc["generation"].GetInt64() : 0;
+    shard.logOffset = 0;
+    shard.logRecords = 0;
+    shard.loaded = true;
+}
+
+/**
+ * @brief  Apply the complete records of the journal of a cart shard that
+ *         have not been applied yet. The caller must hold the lock of shard
+ * @param  shard  The cart shard
+ * @param  locked  True if the caller holds the lock file of the shard
+ */
+void cartReplayLog(CartShard & shard, bool locked) {
+    string logPath = cartShardPath(shard.userid, ".log");
+    string line;
+    long generation = 0;
+
+    if (!shard.loaded)
+        cartLoadSnapshot(shard);
+
+    fstream file(logPath, ios::in | ios::binary);
+
+    if (!file.is_open())
+        return;
+
+    // the first line of journal is the generation of the snapshot
+    // its records are based on, exp: "G\t3"
+    if (!getline(file, line) || file.eof() || line.size() < 3 || line[0] != 'G')
+        return;
+    generation = stol(line.substr(2));
+
+    if (generation != shard.generation) {
+        // another process has compacted the journal since we loaded
+        cartLoadSnapshot(shard);
+
+        // the journal is older than the snapshot, which happens when the
+        // compaction stopped after the snapshot was written. Its records
+        // are already part of the snapshot, so start a new journal
+        if (generation < shard.generation) {
+            file.close();
+
+            {
+                // another process may have finished the compaction and
+                // appended to its journal since the header was read, the
+                // journal is only replaced if it is still the old one
+                unique_ptr<FileLock> lock(locked ? nullptr : new FileLock(cartShardPath(shard.userid, ".lock").c_str()));
+                fstream journal(logPath, ios::in | ios::binary);
+
+                if (getline(journal, line) && line.size() >= 3 && line[0] == 'G' &&
+                    stol(line.substr(2)) < shard.generation) {
+                    journal.close();
+                    journal.open(logPath, ios::out | ios::trunc | ios::binary);
+                    journal << "G\t" << shard.generation << '\n';
+                    return;
+                }
+            }
+
+            // apply the journal that replaced it
+            cartReplayLog(shard, locked);
+            return;
+        }
+
+        if (generation != shard.generation)
+            return;
+    }
+
+    if (shard.logOffset == 0)
+        shard.logOffset = file.tellg();
+
+    file.seekg(shard.logOffset);
+
+    // apply each complete line, a half written record at the end of
+    // journal is left for the next replay
+    while (getline(file, line) && !file.eof()) {
+        cartApplyRecord(shard.doc["cart"], &shard.columns, line, shard.doc.GetAllocator());
+        shard.logOffset += line.size() + 1;
+        shard.logRecords++;
+    }
+}
+
+/**
+ * @brief  Apply one record of the cart journal to a cart
+ * @param  cart  The "cart" array of the user of the record
+ * @param  columns  The columns of the cart kept in step with it, or nullptr
+ * @param  record  A line of the journal without the newline, exp:
+ *                 "A\t<userid>\t<qty>\t<price>\t<name>", "R\t<userid>\t<id>"
+ *                 or "C\t<userid>"
+ * @param  allocator  The allocator of the DOM of cart
+ */
+void cartApplyRecord(Value & cart, CartColumns * columns, const string & record,
+                     Document::AllocatorType & allocator) {
+    vector<string> fields;
+    stringstream str(record);
+    string word;
+
+    // tabs and newlines of the name of product are escaped, so they
+    // never split the record
+    while (getline(str, word, '\t'))
+        fields.push_back(word);
+
+    if (fields.size() < 2)
+        return;
+
+    if (fields[0] == "A" && fields.size() == 5) {
+        int qty = stoi(fields[2]);
+        double price = stod(fields[3]);
+        string name = cartUnescapeField(fields[4]);
+        Value newProduct(kObjectType);
+        Value productName(name.c_str(), (SizeType)name.size(), allocator);
+
+        // add the information of selected product in a key value pair
+        newProduct.AddMember("id", cart.Size() + 1, allocator);
+        newProduct.AddMember("name", productName, allocator);
+        newProduct.AddMember("quantity", qty, allocator);
+        newProduct.AddMember("price", price, allocator);
+        newProduct.AddMember("amount", price * qty, allocator);
+
+        cart.PushBack(newProduct, allocator);
+
+        if (columns != nullptr) {
+            columns->quantity.push_back(qty);
+            columns->price.push_back(price);
+        }
+    }
+    else if (fields[0] == "R" && fields.size() == 3) {
+        int id = stoi(fields[2]);
+
+        if (id < 1 || id > (int)cart.Size())
+            return;
+
+        cart.Erase(cart.Begin() + id - 1);
+
+        if (columns != nullptr) {
+            columns->quantity.erase(columns->quantity.begin() + id - 1);
+            columns->price.erase(columns->price.begin() + id - 1);
+        }
+
+        // reorder the id of each product in cart numerically
+        for (SizeType i = 0; i < cart.Size(); i++) {
+            cart[i]["id"] = i + 1;
+        }
+    }
+    else if (fields[0] == "C") {
+        // lanes of the same user may both clear the cart
+        if (!cart.Empty())
+            cart.Erase(cart.Begin(), cart.End());
+
+        if (columns != nullptr) {
+            columns->quantity.clear();
+            columns->price.clear();
+        }
+    }
+}
+
+/**
+ * @brief  Escape a field of a cart journal record, so it holds no tab or newline
+ * @param  field  The text of the field, exp: "Tea\tbags"
+ * @return  The field with "\\", "\t" and "\n" for its backslashes, tabs
+ *          and newlines, exp: "Tea\\tbags"
+ */
+string cartEscapeField(const string & field) {
+    string escaped;
+
+    escaped.reserve(field.size());
+
+    for (char c : field) {
+        if (c == '\\')
+            escaped += "\\\\";
+        else if (c == '\t')
+            escaped += "\\t";
+        else if (c == '\n')
+            escaped += "\\n";
+        else
+            escaped += c;
+    }
+
+    return escaped;
+}
+
+/**
+ * @brief  Get back a field escaped by cartEscapeField
+ * @param  escaped  The field as written in the journal
+ * @return  The text of the field
+ */
+string cartUnescapeField(const string & escaped) {
+    string field;
+
+    field.reserve(escaped.size());
+
+    for (size_t i = 0; i < escaped.size(); i++) {
+        if (escaped[i] != '\\' || i + 1 == escaped.size()) {
+            field += escaped[i];
+            continue;
+        }
+
+        char c = escaped[++i];
+        field += c == 't' ? '\t' : c == 'n' ? '\n' : c;
+    }
+
+    return field;
+}
+
+/**
+ * @brief  Append a record to the journal of a cart shard and apply it,
+ *         the cost does not depend on the number of users or the carts
+ *         of other users
+ * @param  shard  The cart shard
+ * @param  record  A line of the journal ended with a newline
+ */
+void cartAppendRecord(CartShard & shard, const string & record) {
+    lock_guard<mutex> guard(shard.lock);
+    string logPath = cartShardPath(shard.userid, ".log");
+
+    cartReplayLog(shard);
+
+    {
+        // a compaction of another process must not replace the journal
+        // between its last replay and our append
+        FileLock lock(cartShardPath(shard.userid, ".lock").c_str());
+        error_code ec;
+        bool newJournal = !filesystem::exists(logPath, ec);
+        fstream file(logPath, ios::out | ios::app | ios::binary);
+
+        if (newJournal)
+            file << "G\t" << shard.generation << '\n';
+
+        file << record;
+    }
+
+    // apply our own record together with anything other processes
+    // appended before it, so the journal order is kept
+    cartReplayLog(shard);
+
+    if (shard.logRecords >= CART_COMPACT_RECORDS && !shard.compacting.exchange(true)) {
+        CartShard * compacted = &shard;
+
+        persistQueue(cartShardPath(shard.userid, ".json"), [compacted] {
+            cartCompact(compacted);
+            return true;
+        });
+    }
+}
+
+/**
+ * @brief  Write a cart as the snapshot of a cart shard
+ * @param  path  The location of the snapshot
+ * @param  userid  The userid of the owner of cart
+ * @param  cart  The "cart" array
+ * @param  generation  The generation of the snapshot
+ */
+void cartWriteSnapshot(const string & path, const string & userid, const Value & cart, long generation) {
+    StringBuffer buffer;
+    PrettyWriter<StringBuffer> writer(buffer);
+
+    // exp:
+    // {
+    //    "generation": 4,
+    //    "userid": "1",
+    //    "cart": [...]
+    // }
+    writer.StartObject();
+    writer.Key("generation");
+    writer.Int64(generation);
+    writer.Key("userid");
+    writer.String(userid.c_str());
+    writer.Key("cart");
+    cart.Accept(writer);
+    writer.EndObject();
+
+    fstream file(path, ios::out | ios::binary);
+    file.write(buffer.GetString(), buffer.GetSize());
+}
+
+/**
+ * @brief  Write the cart of a shard as a new snapshot of the next generation
+ *         and start an empty journal. Run by the persister
+ * @param  shard  The cart shard
+ */
+void cartCompact(CartShard * shard) {
+    lock_guard<mutex> guard(shard->lock);
+    FileLock lock(cartShardPath(shard->userid, ".lock").c_str());
+
+    // take the records appended by other processes, and the snapshot if
+    // another process has compacted, the generation is then compared and
+    // increased while no one can append
+    cartReplayLog(*shard, true);
+
+    error_code ec;
+    long generation = shard->generation + 1;
+    string snapshotPath = cartShardPath(shard->userid, ".json");
+    string journalPath = cartShardPath(shard->userid, ".log");
+
+    cartWriteSnapshot(snapshotPath + ".tmp", shard->userid, shard->doc["cart"], generation);
+
+    {
+        fstream file(journalPath + ".tmp", ios::out | ios::binary);
+        file << "G\t" << generation << '\n';
+    }
+
+    // the snapshot is replaced before the journal, a journal with an older
+    // generation than the snapshot is ignored on replay
+    filesystem::rename(snapshotPath + ".tmp", snapshotPath, ec);
+
+    if (!ec) {
+        filesystem::rename(journalPath + ".tmp", journalPath, ec);
+
+        shard->generation = generation;
+        shard->logOffset = 0;
+        shard->logRecords = 0;
+    }
+
+    shard->compacting = false;
+}
+
+/**
+ * @brief  Split the carts of the single cart.json and its journal, used
+ *         before carts were sharded, into one cart shard per user. Done
+ *         once, the carts directory only appears when the split finished
+ */
+void cartMigrateLegacy() {
+    error_code ec;
+    string tempDir = string(CART_DIR_PATH) + ".tmp";
+
+    if (filesystem::exists(CART_DIR_PATH, ec))
+        return;
+
+    FileLock lock(CART_MIGRATE_LOCK_PATH);
+
+    // another process finished the split while we were waiting
+    if (filesystem::exists(CART_DIR_PATH, ec))
+        return;
+
+    filesystem::remove_all(tempDir, ec);
+    filesystem::create_directories(tempDir, ec);
+
+    if (filesystem::exists(LEGACY_CART_FILE_PATH, ec)) {
+        Document legacy = readJsonFile(LEGACY_CART_FILE_PATH);
+        Document::AllocatorType & allocator = legacy.GetAllocator();
+        string line;
+
+        if (!legacy.IsObject() || !legacy.HasMember("users"))
+            legacy.SetObject().AddMember("users", Value(kArrayType), allocator);
+
+        Value & users = legacy["users"];
+        long generation = legacy.HasMember("generation") ? legacy["generation"].GetInt64() : 0;
+        fstream journal(LEGACY_CART_LOG_PATH, ios::in | ios::binary);
+
+        // apply the legacy journal if it belongs to the legacy snapshot
+        if (getline(journal, line) && line.size() > 2 && line[0] == 'G' &&
+            stol(line.substr(2)) == generation) {
+            while (getline(journal, line) && !journal.eof()) {
+                string::size_type begin = line.find('\t') + 1;
+                string userid = line.substr(begin, line.find('\t', begin) - begin);
+                int userPosition = jsonFindUserPosition(users, userid);
+
+                if (userPosition == -1)
+                    userPosition = jsonCreateNewUser(users, userid, allocator);
+
+                cartApplyRecord(users[userPosition]["cart"], nullptr, line, allocator);
+            }
+        }
+        journal.close();
+
+        for (SizeType i = 0; i < users.Size(); i++) {
+            string userid = users[i]["userid"].GetString();
+
+            cartWriteSnapshot(tempDir + '/' + userid + ".json", userid, users[i]["cart"], 0);
+        }
+    }
+
+    filesystem::rename(tempDir, CART_DIR_PATH, ec);
+
+    if (!ec) {
+        filesystem::rename(LEGACY_CART_FILE_PATH, string(LEGACY_CART_FILE_PATH) + ".migrated", ec);
+        filesystem::remove(LEGACY_CART_LOG_PATH, ec);
+    }
+}
+
+/**
+ * @brief  Load the credentials file into the credential table, the file is
+ *         only read again when its modified time or size changed. When it
+ *         only grew, just the records appended since are read
+ * @param  locked  True if the caller holds the credentials lock
+ */
+void credentialsLoad(bool locked) {
+    error_code ec;
+    filesystem::file_time_type modifiedTime = filesystem::last_write_time(CREDENTIALS_FILE_PATH, ec);
+    uintmax_t fileSize = filesystem::file_size(CREDENTIALS_FILE_PATH, ec);
+    string line;
+
+    if (credentialStore.loaded && !ec &&
+        credentialStore.modifiedTime == modifiedTime && credentialStore.fileSize == fileSize)
+        return;
+
+    if (credentialStore.loaded && !ec && fileSize > credentialStore.fileSize) {
+        // no record is rewritten in place while the new ones are read
+        unique_ptr<FileLock> lock(locked ? nullptr : new FileLock(CREDENTIALS_LOCK_PATH));
+
+        if (credentialsLoadAppended())
+            return;
+    }
+
+    credentialStore.records.clear();
+    credentialStore.slots.assign(16, -1);
+
+    // read before the records, a record rewritten after it is
+    // counted later and has the file read again
+    credentialStore.revision = credentialsRevision();
+
+    fstream file(CREDENTIALS_FILE_PATH, ios::in | ios::binary);
+    bool fixedWidth = true;
+
+    if (file.is_open()) {
+        // skip the header line
+        getline(file, line);
+        fixedWidth = !file.eof() && line.size() == CREDENTIAL_RECORD_SIZE - 1;
+
+        while (getline(file, line)) {
+            Credential credential = parseCredential(line);
+
+            // a file written before the records had fixed size
+            if (file.eof() || line.size() != CREDENTIAL_RECORD_SIZE - 1)
+                fixedWidth = false;
+
+            if (!credential.username.empty())
+                credentialsInsert(credential);
+        }
+        file.close();
+
+        if (!fixedWidth) {
+            // the file is upgraded under the lock, after reading it again
+            // in case another process has upgraded it meanwhile
+            if (!locked) {
+                FileLock lock(CREDENTIALS_LOCK_PATH);
+
+                credentialStore.loaded = false;
+                credentialsLoad(true);
+                return;
+            }
+
+            // read the upgraded file, so the position of each credential
+            // in the table is its slot in file
+            if (credentialsUpgradeFile(credentialStore.records)) {
+                credentialStore.loaded = false;
+                credentialsLoad(true);
+                return;
+            }
+        }
+    }
+
+    credentialStore.modifiedTime = modifiedTime;
+    credentialStore.fileSize = fileSize;
+    credentialStore.loaded = true;
+}
+
+/**
+ * @brief  Read the records appended to the credentials file since it was
+ *         read, instead of the whole file. The caller must hold the
+ *         credentials lock
+ * @return  False if a record has been rewritten in place since, or the file
+ *          is not the one read plus whole records, it has to be read again
+ */
+bool credentialsLoadAppended() {
+    error_code ec;
+    filesystem::file_time_type modifiedTime = filesystem::last_write_time(CREDENTIALS_FILE_PATH, ec);
+    uintmax_t fileSize = filesystem::file_size(CREDENTIALS_FILE_PATH, ec);
+
+    // record n of the table is line n + 1 of the file, after the header
+    uintmax_t offset = (credentialStore.records.size() + 1) * CREDENTIAL_RECORD_SIZE;
+
+    if (ec || fileSize < offset || (fileSize - offset) % CREDENTIAL_RECORD_SIZE != 0 ||
+        credentialsRevision() != credentialStore.revision)
+        return false;
+
+    fstream file(CREDENTIALS_FILE_PATH, ios::in | ios::binary);
+    vector<Credential> appended;
+    string line;
+
+    file.seekg(offset);
+    while (appended.size() < (fileSize - offset) / CREDENTIAL_RECORD_SIZE && getline(file, line)) {
+        if (file.eof() || line.size() != CREDENTIAL_RECORD_SIZE - 1)
+            return false;
+
+        appended.push_back(parseCredential(line));
+        if (appended.back().username.empty())
+            return false;
+    }
+
+    if (appended.size() != (fileSize - offset) / CREDENTIAL_RECORD_SIZE)
+        return false;
+
+    for (const Credential & credential : appended)
+        credentialsInsert(credential);
+
+    credentialStore.modifiedTime = modifiedTime;
+    credentialStore.fileSize = fileSize;
+    return true;
+}
+
+/**
+ * @brief  Get the number of times a record of the credentials file has been
+ *         rewritten in place, a process that read the file before a rewrite
+ *         can't just read the records appended since
+ * @return  The number of rewrites, 0 if there was none
+ */
+long credentialsRevision() {
+    long revision = 0;
+    fstream file(CREDENTIALS_REVISION_PATH, ios::in);
+
+    file >> revision;
+    return revision;
+}
+
+/**
+ * @brief  Count a rewrite of the records of the credentials file in place, so
+ *         the processes that read it before read it again. The caller must
+ *         hold the credentials lock
+ */
+void credentialsCountRewrite() {
+    credentialStore.revision = credentialsRevision() + 1;
+
+    fstream file(CREDENTIALS_REVISION_PATH, ios::out | ios::trunc);
+
+    file << credentialStore.revision << '\n';
+}
+
+/**
+ * @brief  Find the credential of a user by username
+ * @param  username  The username of the user
+ * @return  The credential, or nullptr if the username not exist
+ */
+Credential * credentialsFind(const string & username) {
+    size_t mask = credentialStore.slots.size() - 1;
+    size_t i = hashUsername(username) & mask;
+
+    // probe the next slot until the username or an empty slot is found
+    while (credentialStore.slots[i] != -1) {
+        Credential & credential = credentialStore.records[credentialStore.slots[i]];
+
+        if (credential.username == username)
+            return &credential;
+
+        i = (i + 1) & mask;
+    }
+
+    return nullptr;
+}
+
+/**
+ * @brief  Add a credential into the credential table
+ * @param  credential  The credential of a new user
+ */
+void credentialsInsert(const Credential & credential) {
+    // keep the table at most half full so the probe sequences stay short
+    if ((credentialStore.records.size() + 1) * 2 > credentialStore.slots.size())
+        credentialsRehash(credentialStore.slots.size() * 2);
+
+    size_t mask = credentialStore.slots.size() - 1;
+    size_t i = hashUsername(credential.username) & mask;
+
+    while (credentialStore.slots[i] != -1)
+        i = (i + 1) & mask;
+
+    credentialStore.slots[i] = credentialStore.records.size();
+    credentialStore.records.push_back(credential);
+}
+
+/**
+ * @brief  Change the username and password of a credential in the table
+ * @param  credential  The credential to be changed
+ * @param  newUsername  The new username
+ * @param  newPassword  The new password
+ */
+void credentialsRename(Credential * credential, const string & newUsername, const string & newPassword) {
+    if (credential == nullptr)
+        return;
+
+    size_t mask = credentialStore.slots.size() - 1;
+    int record = credential - credentialStore.records.data();
+    size_t i = hashUsername(credential->username) & mask;
+
+    while (credentialStore.slots[i] != record)
+        i = (i + 1) & mask;
+
+    // remove the old username by shifting back the following entries
+    // of the probe sequence, so no tombstone is needed
+    size_t hole = i;
+    size_t j = i;
+
+    while (true) {
+        j = (j + 1) & mask;
+
+        if (credentialStore.slots[j] == -1)
+            break;
+
+        size_t home = hashUsername(credentialStore.records[credentialStore.slots[j]].username) & mask;
+
+        // move the entry into the hole if its home slot is not
+        // between the hole and its current slot
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            credentialStore.slots[hole] = credentialStore.slots[j];
+            hole = j;
+        }
+    }
+    credentialStore.slots[hole] = -1;
+
+    credential->username = newUsername;
+    credential->password = newPassword;
+
+    // insert the new username
+    i = hashUsername(newUsername) & mask;
+
+    while (credentialStore.slots[i] != -1)
+        i = (i + 1) & mask;
+
+    credentialStore.slots[i] = record;
+}
+
+/**
+ * @brief  Rebuild the slots of the credential table with a new size
+ * @param  size  The number of slots, must be a power of two
+ */
+void credentialsRehash(size_t size) {
+    size_t mask = size - 1;
+
+    credentialStore.slots.assign(size, -1);
+
+    for (size_t r = 0; r < credentialStore.records.size(); r++) {
+        size_t i = hashUsername(credentialStore.records[r].username) & mask;
+
+        while (credentialStore.slots[i] != -1)
+            i = (i + 1) & mask;
+
+        credentialStore.slots[i] = r;
+    }
+}
+
+/**
+ * @brief  Record the modified time and size of the credentials file after
+ *         this process changed it, so the table is not loaded again
+ */
+void credentialsStamp() {
+    error_code ec;
+
+    credentialStore.modifiedTime = filesystem::last_write_time(CREDENTIALS_FILE_PATH, ec);
+    credentialStore.fileSize = filesystem::file_size(CREDENTIALS_FILE_PATH, ec);
+}
+
+/**
+ * @brief  Add a new account to the credentials file. Signups of other
+ *         processes wait on the credentials lock, so the username check,
+ *         the new userid and the appended line can not interleave
+ * @param  username  The username of new account
+ * @param  password  The password of new account
+ * @return  The userid of new account, or an empty string if the username
+ *          already exist or the credentials are not valid
+ */
+string credentialsSignup(const string & username, const string & password) {
+    if (!validCredential(username, password))
+        return "";
+
+    FileLock lock(CREDENTIALS_LOCK_PATH);
+
+    credentialsLoad(true);
+
+    if (credentialsFind(username) != nullptr)
+        return "";
+
+    Credential credential = {to_string(allocateUserid()), username, password};
+
+    // open and append the new signup user information 
+    // to the credentials txt file
+    fstream file(CREDENTIALS_FILE_PATH, ios::app | ios::binary);
+
+    file << formatCredential(credential);
+    file.close();
+
+    // keep the credential table in sync without reloading the file
+    credentialsInsert(credential);
+    credentialsStamp();
+
+    return credential.userid;
+}
+
+/**
+ * @brief  Change the username and password of an account by rewriting
+ *         only its own record in the credentials file
+ * @param  username  The current username of the account
+ * @param  password  The current password of the account
+ * @param  newUsername  The new username
+ * @param  newPassword  The new password
+ * @return  False if the current password is wrong, the new credentials
+ *          are not valid or the new username belongs to another account
+ */
+bool credentialsUpdate(const string & username, const string & password,
+                       const string & newUsername, const string & newPassword) {
+    if (!validCredential(newUsername, newPassword))
+        return false;
+
+    FileLock lock(CREDENTIALS_LOCK_PATH);
+
+    credentialsLoad(true);
+
+    Credential * credential = credentialsFind(username);
+    Credential * owner = credentialsFind(newUsername);
+
+    if (credential == nullptr || credential->password != password ||
+        (owner != nullptr && owner != credential))
+        return false;
+
+    // the header line takes the first slot of file
+    long slot = credential - credentialStore.records.data() + 1;
+    Credential updated = {credential->userid, newUsername, newPassword};
+
+    fstream file(CREDENTIALS_FILE_PATH, ios::in | ios::out | ios::binary);
+
+    file.seekp(slot * CREDENTIAL_RECORD_SIZE);
+    file << formatCredential(updated);
+    file.close();
+
+    // counted once the record is written, so a process that reads
+    // the count has read the record too
+    credentialsCountRewrite();
+
+    // keep the credential table in sync without reloading the file
+    credentialsRename(credential, newUsername, newPassword);
+    credentialsStamp();
+
+    return true;
+}
+
+/**
+ * @brief  Format a credential as a fixed size line of credentials file
+ * @param  credential  The credential to be formatted
+ * @return  The line with each field padded by blank, exp:
+ *          "1         ,jeremy      ,1234    \n"
+ */
+string formatCredential(const Credential & credential) {
+    char record[CREDENTIAL_RECORD_SIZE + 1];
+
+    snprintf(record, sizeof(record), "%-*s,%-*s,%-*s\n",
+             USERID_WIDTH, credential.userid.c_str(),
+             USERNAME_WIDTH, credential.username.c_str(),
+             PASSWORD_WIDTH, credential.password.c_str());
+
+    return record;
+}
+
+/**
+ * @brief  Parse a line of credentials file
+ * @param  line  The line, with or without the padding of each field
+ * @return  The credential, with an empty username if the line has none
+ */
+Credential parseCredential(const string & line) {
+    Credential credential;
+    stringstream str(line);
+
+    getline(str, credential.userid, ',');
+    getline(str, credential.username, ',');
+    getline(str, credential.password, ',');
+
+    // remove the padding of each field
+    for (string * field : {&credential.userid, &credential.username, &credential.password})
+        field->erase(field->find_last_not_of(" \r") + 1);
+
+    return credential;
+}
+
+/**
+ * @brief  Rewrite a credentials file of the old variable length format
+ *         with fixed size records, done once. The caller must hold the
+ *         credentials lock. A credential that doesn't fit a record is
+ *         left out, it can't be rewritten without breaking the file
+ * @param  records  The credentials read from the old file
+ * @return  True if the file has been replaced
+ */
+bool credentialsUpgradeFile(const vector<Credential> & records) {
+    string tempPath = uniquePath(string(CREDENTIALS_FILE_PATH) + ".tmp");
+    error_code ec;
+
+    {
+        fstream file(tempPath, ios::out | ios::binary);
+
+        file << formatCredential({"userid", "username", "password"});
+
+        for (const Credential & credential : records) {
+            if (credential.userid.empty() || credential.userid.size() > USERID_WIDTH ||
+                !validCredential(credential.username, credential.password)) {
+                cerr << "skipped credential of userid " << credential.userid << " that doesn't fit a record\n";
+                continue;
+            }
+
+            file << formatCredential(credential);
+        }
+
+        if (!file.good()) {
+            file.close();
+            filesystem::remove(tempPath, ec);
+            return false;
+        }
+    }
+
+    filesystem::rename(tempPath, CREDENTIALS_FILE_PATH, ec);
+    if (ec)
+        return false;
+
+    // the records of the old file are not where they were
+    credentialsCountRewrite();
+    return true;
+}
+
+/**
+ * @brief  Take the next userid from the userid sequence file. The caller
+ *         must hold the credentials lock
+ * @return  A userid that has never been given out before
+ */
+long allocateUserid() {
+    long lastUserid = 0;
+    fstream seqIn(USERID_SEQ_PATH, ios::in);
+
+    if (seqIn >> lastUserid) {
+        seqIn.close();
+    }
+    else {
+        // first run, continue after the largest userid in credentials file
+        for (const Credential & credential : credentialStore.records)
+            lastUserid = max(lastUserid, atol(credential.userid.c_str()));
+    }
+
+    fstream seqOut(USERID_SEQ_PATH, ios::out | ios::trunc);
+    seqOut << lastUserid + 1 << '\n';
+
+    return lastUserid + 1;
+}
+
+FileLock::FileLock(const char * path) {
+#ifdef _WIN32
+    OVERLAPPED overlapped = {};
+
+    handle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                         NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle != INVALID_HANDLE_VALUE)
+        LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped);
+#else
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd != -1)
+        flock(fd, LOCK_EX);
+#endif
+}
+
+FileLock::~FileLock() {
+#ifdef _WIN32
+    if (handle != INVALID_HANDLE_VALUE)
+        CloseHandle(handle);
+#else
+    if (fd != -1)
+        close(fd);
+#endif
+}
+
+/**
+ * @brief  Hash a username with 64-bit FNV-1a
+ * @param  username  The username to be hashed
+ * @return  The hash value
+ */
+size_t hashUsername(const string & username) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (unsigned char c : username) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
 }
 
 /**